@@ -0,0 +1,269 @@
+/*****************************************************************************
+ *
+ *   connie_bench.c
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "connie.h"
+#include "connie_tg.h"
+#include "connie_ui.h"
+#include "reverb.h"
+
+// dsp benchmark of the tonegen without jack
+// sweeps model, preset, vibrato, reverb and number of held keys
+// output: one tab separated line per configuration
+
+// the globals of connie_main.c used by the ui
+const char * connie_version = "bench";
+char *jack_name = "connie_bench";
+char *uuid = NULL;
+char *connie_conf = NULL;
+
+// lowest key and number of keys (see connie_tg.c)
+#define BENCH_LOWKEY 24
+#define BENCH_KEYS 61
+
+static const int bench_keys[] = { 1, 2, 4, 8, 16, 32, 61 };
+#define BENCH_SWEEP ( sizeof( bench_keys ) / sizeof( int ) )
+
+static unsigned int bench_rate = 48000;
+static unsigned int bench_period = 64;
+static int bench_periods = 2000;
+
+static sample_t *out_l;
+static sample_t *out_r;
+static sample_t *wet_r;
+// the outputs of the (one) division for tg_render()
+static sample_t *bench_out[2];
+static double *bench_ns;
+
+
+
+static double now_ns( void ) {
+  struct timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t );
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+
+static int cmp_double( const void *a, const void *b ) {
+  double da = *(const double *)a;
+  double db = *(const double *)b;
+  return da < db ? -1 : da > db;
+}
+
+
+// render some time without measuring
+static void bench_run( double seconds ) {
+  for ( int iii = seconds * bench_rate / bench_period; iii > 0; iii-- )
+    tg_render( bench_out, 0, bench_period );
+}
+
+
+static void bench_note( int on, int key ) {
+  unsigned char event[3] = { on ? 0x90 : 0x80, key, on ? 100 : 0 };
+  tg_midi_in( event, 3 );
+}
+
+
+// measure bench_periods periods and print one result line
+static void bench_measure( FILE *out, const char *config ) {
+  double sum = 0.0;
+  for ( int iii = 0; iii < bench_periods; iii++ ) {
+    double start = now_ns();
+    tg_render( bench_out, 0, bench_period );
+    bench_ns[iii] = ( now_ns() - start ) / bench_period;
+    sum += bench_ns[iii];
+  }
+  qsort( bench_ns, bench_periods, sizeof( double ), cmp_double );
+  double mean = sum / bench_periods;
+  fprintf( out, "%s\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n", config, mean,
+           bench_ns[ bench_periods / 2 ],
+           bench_ns[ bench_periods * 9 / 10 ],
+           bench_ns[ bench_periods * 99 / 100 ],
+           bench_ns[ bench_periods - 1 ],
+           1e9 / bench_rate / mean );
+  fflush( out );
+}
+
+
+// the reverb alone, white noise input
+// lines: 0 mono jcrev, 4, 8, 16 stereo fdn
+static void bench_reverb( FILE *out, int lines ) {
+  static reverb_t rev;
+  static fdn_t fdn;
+  reverb_init( &rev, bench_rate );
+  fdn_init( &fdn, lines, bench_rate );
+  double sum = 0.0;
+  srand( 1 );
+  for ( int iii = 0; iii < bench_periods; iii++ ) {
+    for ( unsigned int frame = 0; frame < bench_period; frame++ )
+      out_l[frame] = rand() / (float)RAND_MAX - 0.5f;
+    double start = now_ns();
+    if ( lines )
+      fdn_process( &fdn, out_l, out_r, wet_r, bench_period );
+    else
+      reverb_process( &rev, out_l, out_r, bench_period );
+    bench_ns[iii] = ( now_ns() - start ) / bench_period;
+    sum += bench_ns[iii];
+  }
+  qsort( bench_ns, bench_periods, sizeof( double ), cmp_double );
+  double mean = sum / bench_periods;
+  fprintf( out, "reverb\t-\t-\t%d\t-\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n", lines, mean,
+           bench_ns[ bench_periods / 2 ],
+           bench_ns[ bench_periods * 9 / 10 ],
+           bench_ns[ bench_periods * 99 / 100 ],
+           bench_ns[ bench_periods - 1 ],
+           1e9 / bench_rate / mean );
+}
+
+
+
+int main( int argc, char *argv[] ) {
+  int c;
+  int model_only = -1;
+  int quick = 0;
+  int threads = 1;
+
+  while ( ( c = getopt( argc, argv, "hi:j:n:p:qr:" ) ) != -1 ) {
+    switch ( c ) {
+      case 'i':
+        model_only = atoi( optarg );
+        break;
+      case 'j':
+        threads = atoi( optarg );
+        break;
+      case 'n':
+        bench_periods = atoi( optarg );
+        if ( bench_periods < 10 )
+          bench_periods = 10;
+        break;
+      case 'p':
+        bench_period = atoi( optarg );
+        if ( bench_period < 1 || bench_period > 8192 )
+          bench_period = 64;
+        break;
+      case 'q':
+        quick = 1;
+        break;
+      case 'r':
+        bench_rate = atoi( optarg );
+        if ( bench_rate < 8000 || bench_rate > 192000 )
+          bench_rate = 48000;
+        break;
+      default:
+        printf( "usage: connie_bench [opts]\n" );
+        printf( "  -i INSTRUMENT\t\tonly this model (0: connie, 1: poor-man's-hammond)\n" );
+        printf( "  -j THREADS\t\tmix the notes in THREADS threads, default 1\n" );
+        printf( "  -n PERIODS\t\tmeasured periods per configuration, default 2000\n" );
+        printf( "  -p FRAMES\t\tperiod size, default 64\n" );
+        printf( "  -q\t\t\tquick: only presets 0 and 9, vibrato and reverb on\n" );
+        printf( "  -r RATE\t\tsample rate, default 48000\n" );
+        exit( 1 );
+    }
+  }
+
+  // results to stdout, all other messages to stderr
+  FILE *out = fdopen( dup( 1 ), "w" );
+  dup2( 2, 1 );
+
+  out_l = malloc( bench_period * sizeof( sample_t ) );
+  out_r = malloc( bench_period * sizeof( sample_t ) );
+  wet_r = malloc( bench_period * sizeof( sample_t ) );
+  bench_ns = malloc( bench_periods * sizeof( double ) );
+  bench_out[0] = out_l;
+  bench_out[1] = out_r;
+  if ( !out || !out_l || !out_r || !wet_r || !bench_ns ) {
+    fprintf( stderr, "memory allocation failed\n" );
+    exit( 1 );
+  }
+
+  fprintf( out, "# connie_bench rate=%u period=%u periods=%d threads=%d\n",
+           bench_rate, bench_period, bench_periods, threads );
+  fprintf( out, "# model\tpreset\tvibrato\treverb\tkeys\tns_frame\tp50\tp90\tp99\tmax\trt_factor\n" );
+
+  for ( int model = CONNIE; model <= HAMMOND; model++ ) {
+    if ( model_only >= 0 && model != model_only )
+      continue;
+    connie_model = model;
+    tg_init( bench_rate );
+    tg_wait();
+    tg_threads( threads, 0 );
+    ui_setup( model, QWERTY );
+    int presets = ui_get_presets();
+
+    for ( int preset = 0; preset < presets; preset++ ) {
+      if ( quick && preset != 0 && preset != presets - 1 )
+        continue;
+      for ( int fx = quick ? 3 : 0; fx < 4; fx++ ) {
+        ui_set_program( preset );
+        // the preset values or off
+        if ( !( fx & 1 ) )
+          tg_vibrato = 0.0;
+        else if ( !tg_vibrato )
+          tg_vibrato = 0.5;
+        if ( !( fx & 2 ) )
+          tg_reverb = 0.0;
+        else if ( !tg_reverb )
+          tg_reverb = 0.25;
+        tg_publish();
+
+        int held = 0;
+        for ( unsigned int sweep = 0; sweep < BENCH_SWEEP; sweep++ ) {
+          // press more keys, settle the attack
+          while ( held < bench_keys[sweep] )
+            bench_note( 1, BENCH_LOWKEY + held++ );
+          bench_run( 0.2 );
+          char config[64];
+          snprintf( config, sizeof( config ), "%s\t%d\t%d\t%d\t%d",
+                    CONNIE == model ? "connie" : "hammond",
+                    preset, fx & 1, fx >> 1, held );
+          bench_measure( out, config );
+        }
+        // release all keys, let them fade out
+        while ( held )
+          bench_note( 0, BENCH_LOWKEY + --held );
+        bench_run( 0.5 );
+      } // for ( fx )
+    } // for ( preset )
+    tg_shutdown();
+  } // for ( model )
+
+  // the reverbs alone, reverb column: 0 mono jcrev, 4, 8, 16 lines fdn
+  for ( int lines = 0; lines <= 16; lines = lines ? 2 * lines : 4 )
+    bench_reverb( out, lines );
+
+  fclose( out );
+  free( out_l );
+  free( out_r );
+  free( wet_r );
+  free( bench_ns );
+  return 0;
+}
@@ -0,0 +1,146 @@
+/*****************************************************************************
+ *
+ *   connie_cache.c
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "connie_cache.h"
+
+
+// file layout: header (one page), then the tables
+#define CACHE_MAGIC "CONNIEWT"
+#define CACHE_HEADER 4096
+
+typedef struct {
+  char magic[8];
+  cache_key_t key;
+} cache_header_t;
+
+
+
+// size of the whole file
+static size_t cache_size( const cache_key_t *key ) {
+  return CACHE_HEADER + (size_t)key->size * key->tables * sizeof( float );
+}
+
+
+
+// path of the cache file for key, creates the directory
+// returns 0 if there is no place for a cache
+static int cache_path( const cache_key_t *key, char *path, size_t len ) {
+  char dir[1024];
+  const char *xdg = getenv( "XDG_CACHE_HOME" );
+  const char *home = getenv( "HOME" );
+  if ( xdg && *xdg )
+    snprintf( dir, sizeof( dir ), "%s", xdg );
+  else if ( home && *home )
+    snprintf( dir, sizeof( dir ), "%s/.cache", home );
+  else
+    return 0;
+  mkdir( dir, 0755 );
+  strncat( dir, "/connie", sizeof( dir ) - strlen( dir ) - 1 );
+  if ( mkdir( dir, 0755 ) && EEXIST != errno )
+    return 0;
+  // the partials as a short hash (fnv-1a), the header has them all
+  unsigned int hash = 2166136261u;
+  for ( int oct = 0; oct < CACHE_OCTAVES; oct++ )
+    hash = ( hash ^ key->partials[ oct ] ) * 16777619u;
+  int n = snprintf( path, len, "%s/voices-v%u-%d-%u-%u-%08x.bin", dir,
+                    key->version, key->model, key->sample_rate,
+                    key->size, hash );
+  return n > 0 && n < len;
+}
+
+
+
+const float *cache_map( const cache_key_t *key ) {
+  char path[1280];
+  if ( !cache_path( key, path, sizeof( path ) ) )
+    return NULL;
+  int fd = open( path, O_RDONLY );
+  if ( fd < 0 )
+    return NULL;
+  struct stat st;
+  if ( fstat( fd, &st ) || st.st_size != cache_size( key ) ) {
+    close( fd );
+    return NULL;
+  }
+  void *map = mmap( NULL, cache_size( key ), PROT_READ, MAP_SHARED, fd, 0 );
+  close( fd );
+  if ( MAP_FAILED == map )
+    return NULL;
+  // a stale or foreign file
+  const cache_header_t *header = map;
+  if ( memcmp( header->magic, CACHE_MAGIC, 8 )
+       || memcmp( &header->key, key, sizeof( cache_key_t ) ) ) {
+    munmap( map, cache_size( key ) );
+    return NULL;
+  }
+  return (const float *)( (const char *)map + CACHE_HEADER );
+}
+
+
+
+const float *cache_store( const cache_key_t *key, const float *data ) {
+  char path[1280];
+  char tmp[1300];
+  if ( !cache_path( key, path, sizeof( path ) ) )
+    return NULL;
+  // write a private file and rename it, other instances see all or nothing
+  snprintf( tmp, sizeof( tmp ), "%s.%d", path, (int)getpid() );
+  FILE *f = fopen( tmp, "wb" );
+  if ( !f )
+    return NULL;
+  char header[CACHE_HEADER];
+  memset( header, 0, CACHE_HEADER );
+  cache_header_t *h = (cache_header_t *)header;
+  memcpy( h->magic, CACHE_MAGIC, 8 );
+  h->key = *key;
+  size_t n = (size_t)key->size * key->tables;
+  int ok = 1 == fwrite( header, CACHE_HEADER, 1, f )
+           && n == fwrite( data, sizeof( float ), n, f );
+  if ( fclose( f ) )
+    ok = 0;
+  if ( !ok || rename( tmp, path ) ) {
+    unlink( tmp );
+    return NULL;
+  }
+  return cache_map( key );
+}
+
+
+
+void cache_unmap( const cache_key_t *key, const float *data ) {
+  if ( data )
+    munmap( (char *)data - CACHE_HEADER, cache_size( key ) );
+}
@@ -0,0 +1,58 @@
+/*****************************************************************************
+ *
+ *   connie_cache.h
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+#ifndef CONNIE_CACHE_H
+#define CONNIE_CACHE_H
+
+#include <stddef.h>
+
+// persistent cache of the generated wavetables
+//
+// the tables are written once into $XDG_CACHE_HOME/connie (~/.cache/connie)
+// and mmap'ed read-only on later starts, so several instances share the pages.
+// one file per key, the header is checked before use
+
+// max. octaves with their own number of partials
+#define CACHE_OCTAVES 8
+
+// everything the tables depend on
+// not the tuning itself, only the partials it allows below nyquist
+typedef struct {
+  unsigned int version;        // of the table generator, bump if it changes
+  unsigned int sample_rate;
+  int model;
+  unsigned int size;           // floats per table
+  unsigned int tables;
+  unsigned int partials[ CACHE_OCTAVES ]; // of each octave, 0 if unused
+} cache_key_t;
+
+// map the tables for key read-only, NULL if not cached
+extern const float *cache_map( const cache_key_t *key );
+
+// write the tables for key into the cache and map them, NULL on failure
+extern const float *cache_store( const cache_key_t *key, const float *data );
+
+// unmap tables returned by cache_map() or cache_store()
+extern void cache_unmap( const cache_key_t *key, const float *data );
+
+#endif
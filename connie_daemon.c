@@ -0,0 +1,368 @@
+/*****************************************************************************
+ *
+ *   connie_daemon.c
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "connie.h"
+#include "connie_tg.h"
+#include "connie_ui.h"
+#include "connie_daemon.h"
+
+
+// clients at the same time
+#define DAEMON_CLIENTS 8
+// longest command line
+#define DAEMON_LINE 256
+
+// epoll data of the socket, the tonegen and the timer,
+// clients are 0..DAEMON_CLIENTS-1
+#define DAEMON_LISTEN DAEMON_CLIENTS
+#define DAEMON_NOTIFY ( DAEMON_CLIENTS + 1 )
+#define DAEMON_TIMER ( DAEMON_CLIENTS + 2 )
+
+// ms between the looks for midi commands, as the terminal ui
+#define DAEMON_TICK 10
+
+typedef struct {
+  int fd; // -1: free
+  int len;
+  char line[DAEMON_LINE];
+} daemon_client_t;
+
+static daemon_client_t daemon_client[DAEMON_CLIENTS];
+static char *daemon_path = NULL;
+static int daemon_epoll = -1;
+// connected midi inputs, the timer runs while there are any
+static int daemon_midi_inputs = 0;
+
+
+
+char *daemon_socket( const char *name ) {
+  const char *dir = getenv( "XDG_RUNTIME_DIR" );
+  char *path = NULL;
+  if ( asprintf( &path, "%s/connie-%s.sock", dir && *dir ? dir : "/tmp", name ) < 0 ) {
+    fprintf( stderr,"memory allocation failed\n" );
+    exit( 1 );
+  }
+  return path;
+}
+
+
+
+// called via atexit()
+static void daemon_shutdown( void ) {
+  if ( daemon_path )
+    unlink( daemon_path );
+}
+
+
+
+// one line "ok ..." with the actual values
+static int daemon_status( char *reply, int size ) {
+  int draws[20];
+  ui_get_drawbars( draws );
+  int len = snprintf( reply, size,
+                      "ok division %s model %d scale %d pitch %.1f transpose %d reverb %d presets %d drawbars",
+                      tg_div_name( tg_division ), connie_model, intonation, concert_pitch,
+                      transpose, tg_reverb_lines, ui_get_presets() );
+  for ( int i = 1; i <= draws[0] && len < size; i++ )
+    len += snprintf( reply + len, size - len, " %d", draws[i] );
+  return len;
+}
+
+
+
+// execute one command line, the reply without newline
+// returns 1 if the client quits
+static int daemon_command( char *line, char *reply, int size ) {
+  char *save;
+  const char *cmd = strtok_r( line, " \t\r", &save );
+  const char *arg = strtok_r( NULL, " \t\r", &save );
+  char *end = NULL;
+  long val = arg ? strtol( arg, &end, 10 ) : 0;
+  int number = arg && end != arg && !*end;
+
+  if ( !cmd ) {
+    snprintf( reply, size, "error empty command" );
+  } else if ( !strcmp( cmd, "quit" ) ) {
+    return 1;
+  } else if ( !strcmp( cmd, "status" ) ) {
+    daemon_status( reply, size );
+  } else if ( !strcmp( cmd, "panic" ) ) {
+    tg_panic();
+    snprintf( reply, size, "ok" );
+  } else if ( !strcmp( cmd, "preset" ) ) {
+    if ( !number || val < 0 || val >= ui_get_presets() ) {
+      snprintf( reply, size, "error preset 0..%d", ui_get_presets() - 1 );
+      return 0;
+    }
+    ui_set_program( val );
+    daemon_status( reply, size );
+  } else if ( !strcmp( cmd, "drawbars" ) ) {
+    int draws[20];
+    ui_get_drawbars( draws );
+    int count = 0;
+    for ( ; arg; arg = strtok_r( NULL, " \t\r", &save ) ) {
+      val = strtol( arg, &end, 10 );
+      if ( end == arg || *end || val < 0 || val > 8 || count >= draws[0] ) {
+        snprintf( reply, size, "error up to %d drawbars 0..8", draws[0] );
+        return 0;
+      }
+      draws[++count] = val;
+    }
+    ui_set_drawbars( draws ); // the ones not given keep their values
+    daemon_status( reply, size );
+  } else if ( !strcmp( cmd, "division" ) ) {
+    for ( int d = 0; d < tg_divisions && arg && !number; d++ ) {
+      if ( !strcmp( arg, tg_div_name( d ) ) ) {
+        val = d;
+        number = 1;
+      }
+    }
+    if ( !number || val < 0 || val >= tg_divisions ) {
+      snprintf( reply, size, "error division 0..%d or name", tg_divisions - 1 );
+      return 0;
+    }
+    ui_set_division( val );
+    daemon_status( reply, size );
+  } else if ( !strcmp( cmd, "scale" ) ) {
+    if ( !number || val < 0 || val >= NSCALES ) {
+      snprintf( reply, size, "error scale 0..%d", NSCALES - 1 );
+      return 0;
+    }
+    ui_set_tuning( val, concert_pitch, transpose );
+    daemon_status( reply, size );
+  } else if ( !strcmp( cmd, "pitch" ) ) {
+    float pitch = arg ? strtof( arg, &end ) : 0;
+    if ( !arg || end == arg || *end || pitch < 220 || pitch > 880 ) {
+      snprintf( reply, size, "error pitch 220..880" );
+      return 0;
+    }
+    ui_set_tuning( intonation, pitch, transpose );
+    daemon_status( reply, size );
+  } else if ( !strcmp( cmd, "transpose" ) ) {
+    if ( !number || val < -12 || val > 12 ) {
+      snprintf( reply, size, "error transpose -12..12" );
+      return 0;
+    }
+    ui_set_tuning( intonation, concert_pitch, val );
+    daemon_status( reply, size );
+  } else if ( !strcmp( cmd, "reverb" ) ) {
+    if ( !number || ( val != 0 && val != 4 && val != 8 && val != 16 ) ) {
+      snprintf( reply, size, "error reverb 0, 4, 8 or 16" );
+      return 0;
+    }
+    tg_reverb_lines = val;
+    tg_publish();
+    daemon_status( reply, size );
+  } else {
+    snprintf( reply, size, "error unknown command %s", cmd );
+  }
+  return 0;
+} // daemon_command()
+
+
+
+static void daemon_drop( daemon_client_t *client ) {
+  close( client->fd ); // leaves the epoll set
+  client->fd = -1;
+}
+
+
+
+// answer a client, a slow or gone reader is dropped (no SIGPIPE)
+static int daemon_write( daemon_client_t *client, const char *reply ) {
+  if ( send( client->fd, reply, strlen( reply ), MSG_NOSIGNAL ) < 0 ) {
+    daemon_drop( client );
+    return -1;
+  }
+  return 0;
+}
+
+
+
+// read from a client, execute and answer each complete line
+static void daemon_read( daemon_client_t *client ) {
+  ssize_t n = read( client->fd, client->line + client->len, DAEMON_LINE - client->len );
+  if ( n < 0 && ( EAGAIN == errno || EINTR == errno ) )
+    return;
+  if ( n <= 0 ) {
+    daemon_drop( client );
+    return;
+  }
+  client->len += n;
+  char *line = client->line;
+  char *eol;
+  while ( ( eol = memchr( line, '\n', client->line + client->len - line ) ) ) {
+    *eol = '\0';
+    char reply[DAEMON_LINE];
+    if ( daemon_command( line, reply, sizeof( reply ) - 1 ) ) {
+      daemon_drop( client );
+      return;
+    }
+    strcat( reply, "\n" );
+    if ( daemon_write( client, reply ) )
+      return;
+    line = eol + 1;
+  }
+  client->len -= line - client->line;
+  memmove( client->line, line, client->len );
+  if ( DAEMON_LINE == client->len ) {
+    client->len = 0;
+    daemon_write( client, "error line too long\n" );
+  }
+} // daemon_read()
+
+
+
+static void daemon_add( int fd, unsigned int id ) {
+  struct epoll_event ev = { .events = EPOLLIN, .data.u32 = id };
+  if ( epoll_ctl( daemon_epoll, EPOLL_CTL_ADD, fd, &ev ) ) {
+    perror( "connie: epoll_ctl" );
+    exit( 1 );
+  }
+}
+
+
+
+void daemon_midi( int change ) {
+  __atomic_add_fetch( &daemon_midi_inputs, change, __ATOMIC_ACQ_REL );
+  tg_wake(); // start or stop the timer
+}
+
+
+
+// look for midi commands every DAEMON_TICK ms while midi is connected
+// the rt thread does not wake us for them
+static void daemon_timer( int timer, int on ) {
+  struct itimerspec it = { { 0, 0 }, { 0, 0 } };
+  if ( on ) {
+    it.it_interval.tv_nsec = DAEMON_TICK * 1000000L;
+    it.it_value = it.it_interval;
+  }
+  if ( timerfd_settime( timer, 0, &it, NULL ) ) {
+    perror( "connie: timerfd_settime" );
+    exit( 1 );
+  }
+}
+
+
+
+void daemon_loop( const char *path ) {
+  // the tonegen and the timer wake us up
+  int notify = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  int timer = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+  daemon_epoll = epoll_create1( EPOLL_CLOEXEC );
+  int listener = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+  if ( notify < 0 || timer < 0 || daemon_epoll < 0 || listener < 0 ) {
+    perror( "connie: daemon" );
+    exit( 1 );
+  }
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  if ( strlen( path ) >= sizeof( addr.sun_path ) ) {
+    fprintf( stderr, "connie: socket path too long: %s\n", path );
+    exit( 1 );
+  }
+  strcpy( addr.sun_path, path );
+  unlink( path ); // left over from a crash
+  if ( bind( listener, (struct sockaddr *)&addr, sizeof( addr ) ) || listen( listener, DAEMON_CLIENTS ) ) {
+    perror( path );
+    exit( 1 );
+  }
+  daemon_path = strdup( path );
+  atexit( daemon_shutdown );
+  printf( "control socket: %s\n", path );
+  fflush( stdout );
+
+  for ( int c = 0; c < DAEMON_CLIENTS; c++ )
+    daemon_client[c].fd = -1;
+  daemon_add( listener, DAEMON_LISTEN );
+  daemon_add( notify, DAEMON_NOTIFY );
+  daemon_add( timer, DAEMON_TIMER );
+  tg_notify( notify );
+
+  int ticking = 0;
+  tg_idle();
+  for ( ;; ) {
+    // midi connected or not since the last time
+    const int midi = __atomic_load_n( &daemon_midi_inputs, __ATOMIC_ACQUIRE ) > 0;
+    if ( midi != ticking ) {
+      daemon_timer( timer, midi );
+      ticking = midi;
+    }
+    struct epoll_event ev[DAEMON_CLIENTS + 3];
+    int n = epoll_wait( daemon_epoll, ev, DAEMON_CLIENTS + 3, -1 );
+    if ( n < 0 && EINTR != errno ) {
+      perror( "connie: epoll_wait" );
+      exit( 1 );
+    }
+    for ( int e = 0; e < n; e++ ) {
+      unsigned int id = ev[e].data.u32;
+      if ( DAEMON_NOTIFY == id || DAEMON_TIMER == id ) {
+        uint64_t count;
+        ssize_t got = read( DAEMON_NOTIFY == id ? notify : timer, &count, sizeof( count ) );
+        (void)got; // just wake up
+      } else if ( DAEMON_LISTEN == id ) {
+        int fd = accept4( listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+        if ( fd < 0 )
+          continue;
+        int c = 0;
+        while ( c < DAEMON_CLIENTS && daemon_client[c].fd >= 0 )
+          c++;
+        if ( c == DAEMON_CLIENTS ) {
+          daemon_client_t full = { .fd = fd };
+          daemon_write( &full, "error too many clients\n" );
+          if ( full.fd >= 0 )
+            close( fd );
+          continue;
+        }
+        daemon_client[c].fd = fd;
+        daemon_client[c].len = 0;
+        daemon_add( fd, c );
+      } else if ( daemon_client[id].fd >= 0 ) {
+        daemon_read( daemon_client + id );
+      }
+    }
+    // commands from the rt thread (midi)
+    int tg_cmd, tg_arg;
+    while ( tg_get_cmd( &tg_cmd, &tg_arg ) )
+      ui_command( tg_cmd, tg_arg );
+    tg_idle();
+    // jack session: save, and maybe quit
+    if ( ui_session() )
+      return;
+  }
+} // daemon_loop()
@@ -0,0 +1,55 @@
+/*****************************************************************************
+ *
+ *   connie_daemon.h
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+#ifndef CONNIE_DAEMON_H
+#define CONNIE_DAEMON_H
+
+// headless control without a terminal (--daemon)
+//
+// sleeps in epoll until a client sends a command to the unix socket,
+// the tonegen has work (see tg_notify()) or midi may have sent commands
+// (see daemon_midi()), one command per line:
+//   status                 ok division upper model 0 scale 0 pitch 440.0 ...
+//   drawbars D1 D2 ...     values 0..8 of the actual division
+//   preset N
+//   division N|NAME        the one drawbars and presets act on
+//   scale N, pitch HZ, transpose N
+//   reverb LINES           0 (mono), 4, 8 or 16
+//   panic
+//   quit                   close this connection
+// each command is answered with one line "ok ..." or "error ..."
+
+// the socket path when none is given: $XDG_RUNTIME_DIR/connie-NAME.sock
+// or /tmp/connie-NAME.sock, malloc'ed
+extern char *daemon_socket( const char *name );
+
+// returns when a jack session save asks to quit, exit() on errors and signals,
+// the socket is removed via atexit()
+extern void daemon_loop( const char *path );
+
+// a midi input was connected ( 1 ) or disconnected ( -1 ), from any thread
+// but the rt thread: while one is connected the daemon looks for midi
+// program changes and tuning cc every 10 ms, else it sleeps
+extern void daemon_midi( int change );
+
+#endif
@@ -0,0 +1,80 @@
+/*****************************************************************************
+ *
+ *   connie_fifo.h
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+#ifndef CONNIE_FIFO_H
+#define CONNIE_FIFO_H
+
+// lock free single producer single consumer command queue
+// e.g. ui thread -> rt thread, never blocks, no syscalls
+// head and tail live in different cache lines
+
+#define FIFO_SIZE 256 // power of 2
+
+typedef struct {
+  int cmd;
+  int arg;
+} fifo_cmd_t;
+
+typedef struct {
+  unsigned int head __attribute__ (( aligned( 64 ) )); // producer
+  unsigned int tail __attribute__ (( aligned( 64 ) )); // consumer
+  fifo_cmd_t buf[FIFO_SIZE] __attribute__ (( aligned( 64 ) ));
+} fifo_t;
+
+
+
+// producer: append a command, returns -1 if full
+static inline int fifo_put( fifo_t *fifo, int cmd, int arg ) {
+  unsigned int head = fifo->head;
+  if ( head - __atomic_load_n( &fifo->tail, __ATOMIC_ACQUIRE ) >= FIFO_SIZE )
+    return -1;
+  fifo->buf[ head & ( FIFO_SIZE - 1 ) ].cmd = cmd;
+  fifo->buf[ head & ( FIFO_SIZE - 1 ) ].arg = arg;
+  __atomic_store_n( &fifo->head, head + 1, __ATOMIC_RELEASE );
+  return 0;
+}
+
+
+
+// consumer: get the oldest command, returns 0 if empty
+static inline int fifo_get( fifo_t *fifo, fifo_cmd_t *cmd ) {
+  unsigned int tail = fifo->tail;
+  if ( tail == __atomic_load_n( &fifo->head, __ATOMIC_ACQUIRE ) )
+    return 0;
+  *cmd = fifo->buf[ tail & ( FIFO_SIZE - 1 ) ];
+  __atomic_store_n( &fifo->tail, tail + 1, __ATOMIC_RELEASE );
+  return 1;
+}
+
+
+
+// consumer: look at the oldest command without taking it, returns 0 if empty
+static inline int fifo_peek( fifo_t *fifo, fifo_cmd_t *cmd ) {
+  unsigned int tail = fifo->tail;
+  if ( tail == __atomic_load_n( &fifo->head, __ATOMIC_ACQUIRE ) )
+    return 0;
+  *cmd = fifo->buf[ tail & ( FIFO_SIZE - 1 ) ];
+  return 1;
+}
+
+#endif
@@ -0,0 +1,332 @@
+/*****************************************************************************
+ *
+ *   connie_latency.c
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+#include <jack/jack.h>
+#include <jack/midiport.h>
+
+// end to end latency of a running connie: note-on into midi_in,
+// first sample above the threshold on its outputs
+// two jack clients: one writes the notes, the other one reads the audio,
+// jack runs them before and after connie in the same cycle, so the frame
+// time of the note and of the onset compare directly (one client would
+// close a feedback loop and jack would delay the audio by a period)
+// output: one tab separated line per period size and preset
+
+#define LAT_MAX_NOTES 10000
+
+// settle times in ms
+#define LAT_PERIOD_SETTLE 500  // after a period size change
+#define LAT_PRESET_SETTLE 300  // after a program change (premix)
+#define LAT_QUIET 200          // silence before each note
+#define LAT_TIMEOUT 2000       // no onset: missed
+#define LAT_TAIL 10000         // no silence (reverb tail): missed
+
+static jack_client_t *lat_midi_client;
+static jack_client_t *lat_audio_client;
+static jack_port_t *lat_midi_port;
+static jack_port_t *lat_audio_port[2];
+
+static float lat_threshold = 0.001f; // -60 dBFS
+
+// main -> midi client: the next event, taken at its next cycle
+// 0: none, else 1 << 31 | measure << 30 | offset << 24 (0..63 / 64 of the period)
+//   | status << 16 | data1 << 8 | data2
+static unsigned int lat_event = 0;
+// midi client -> audio client: frame of the measured note-on
+static jack_nframes_t lat_sent;
+static int lat_armed = 0;
+// audio client -> main: onset of the measured note, last loud frame
+static jack_nframes_t lat_onset;
+static int lat_done = 0;
+static jack_nframes_t lat_loud;
+
+
+
+// the notes (and program changes) into connie
+static int lat_midi_cb( jack_nframes_t nframes, void *arg ) {
+  void *buffer = jack_port_get_buffer( lat_midi_port, nframes );
+  jack_midi_clear_buffer( buffer );
+  unsigned int event = __atomic_exchange_n( &lat_event, 0, __ATOMIC_ACQ_REL );
+  if ( event ) {
+    jack_nframes_t offset = ( ( event >> 24 ) & 63 ) * nframes / 64;
+    jack_midi_data_t data[3] = { event >> 16, event >> 8, event };
+    int size = 0xC0 == ( data[0] & 0xF0 ) ? 2 : 3;
+    jack_midi_event_write( buffer, offset, data, size );
+    if ( event & 1 << 30 ) {
+      lat_sent = jack_last_frame_time( lat_midi_client ) + offset;
+      __atomic_store_n( &lat_armed, 1, __ATOMIC_RELEASE );
+    }
+  }
+  return 0;
+}
+
+
+
+// the outputs of connie: onset and silence
+static int lat_audio_cb( jack_nframes_t nframes, void *arg ) {
+  jack_nframes_t start = jack_last_frame_time( lat_audio_client );
+  int armed = __atomic_load_n( &lat_armed, __ATOMIC_ACQUIRE );
+  for ( int ch = 0; ch < 2; ch++ ) {
+    const jack_default_audio_sample_t *in = jack_port_get_buffer( lat_audio_port[ch], nframes );
+    for ( jack_nframes_t frame = 0; frame < nframes; frame++ ) {
+      if ( fabsf( in[frame] ) < lat_threshold )
+        continue;
+      jack_nframes_t now = start + frame;
+      if ( (int)( now - lat_loud ) > 0 )
+        __atomic_store_n( &lat_loud, now, __ATOMIC_RELAXED );
+      if ( armed && (int)( now - lat_sent ) >= 0 ) {
+        // the earlier of both channels
+        if ( !__atomic_load_n( &lat_done, __ATOMIC_RELAXED ) || (int)( now - lat_onset ) < 0 ) {
+          lat_onset = now;
+          __atomic_store_n( &lat_done, 1, __ATOMIC_RELEASE );
+        }
+        break;
+      }
+    }
+  }
+  if ( armed && __atomic_load_n( &lat_done, __ATOMIC_RELAXED ) )
+    __atomic_store_n( &lat_armed, 0, __ATOMIC_RELAXED );
+  return 0;
+}
+
+
+
+// hand an event to the midi client and wait until it is taken
+static void lat_send( unsigned int event ) {
+  __atomic_store_n( &lat_event, event, __ATOMIC_RELEASE );
+  for ( int ms = 0; ms < LAT_TIMEOUT && __atomic_load_n( &lat_event, __ATOMIC_ACQUIRE ); ms++ )
+    usleep( 1000 );
+}
+
+
+
+// wait until connie has been quiet for LAT_QUIET ms, returns 0 on timeout
+static int lat_wait_quiet( jack_nframes_t rate ) {
+  for ( int ms = 0; ms < LAT_TAIL; ms++ ) {
+    jack_nframes_t quiet = jack_frame_time( lat_audio_client ) - __atomic_load_n( &lat_loud, __ATOMIC_RELAXED );
+    if ( quiet > rate / 1000 * LAT_QUIET )
+      return 1;
+    usleep( 1000 );
+  }
+  return 0;
+}
+
+
+
+static int cmp_int( const void *a, const void *b ) {
+  return *(const int *)a - *(const int *)b;
+}
+
+
+
+// open a client, exit on failure
+static jack_client_t *lat_client( const char *name ) {
+  jack_status_t status;
+  jack_client_t *client = jack_client_open( name, JackNoStartServer, &status );
+  if ( !client ) {
+    fprintf( stderr, "connie_latency: cannot connect to the jack server, status 0x%x\n", status );
+    exit( 1 );
+  }
+  return client;
+}
+
+
+
+// a list of numbers "32,64,256", returns the count
+static int lat_list( const char *arg, int *list, int size ) {
+  int count = 0;
+  for ( char *end; *arg && count < size; arg = *end ? end + 1 : end ) {
+    list[count++] = strtol( arg, &end, 10 );
+    if ( end == arg )
+      break;
+  }
+  return count;
+}
+
+
+
+int main( int argc, char *argv[] ) {
+  int c;
+  const char *connie = "connie";
+  int periods[16], presets[16];
+  int period_count = 0, preset_count = 1;
+  presets[0] = 0;
+  int notes = 100;
+  int channel = 1;
+  int key = 60;
+
+  while ( ( c = getopt( argc, argv, "c:hk:n:N:p:P:t:" ) ) != -1 ) {
+    switch ( c ) {
+      case 'c':
+        channel = atoi( optarg );
+        if ( channel < 1 || channel > 16 )
+          channel = 1;
+        break;
+      case 'k':
+        key = atoi( optarg ) & 0x7F;
+        break;
+      case 'n':
+        connie = optarg;
+        break;
+      case 'N':
+        notes = atoi( optarg );
+        if ( notes < 1 || notes > LAT_MAX_NOTES )
+          notes = 100;
+        break;
+      case 'p':
+        period_count = lat_list( optarg, periods, 16 );
+        break;
+      case 'P':
+        preset_count = lat_list( optarg, presets, 16 );
+        break;
+      case 't':
+        lat_threshold = powf( 10.0f, -fabsf( atof( optarg ) ) / 20.0f );
+        break;
+      default:
+        printf( "usage: connie_latency [opts]\n" );
+        printf( "  -c CHANNEL\t\tmidi channel of connie (1..16), default 1\n" );
+        printf( "  -k KEY\t\tmidi note, default 60\n" );
+        printf( "  -n NAME\t\tjack name of connie, default connie\n" );
+        printf( "  -N NOTES\t\tnotes per configuration, default 100\n" );
+        printf( "  -p FRAMES,...\t\tperiod sizes, default the actual one\n" );
+        printf( "  -P PRESET,...\t\tpresets, default 0\n" );
+        printf( "  -t DB\t\t\tonset threshold in dBFS, default -60\n" );
+        exit( 1 );
+    }
+  }
+
+  lat_midi_client = lat_client( "connie_latency_midi" );
+  lat_audio_client = lat_client( "connie_latency_audio" );
+  lat_midi_port = jack_port_register( lat_midi_client, "midi_out", JACK_DEFAULT_MIDI_TYPE, JackPortIsOutput, 0 );
+  lat_audio_port[0] = jack_port_register( lat_audio_client, "left", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0 );
+  lat_audio_port[1] = jack_port_register( lat_audio_client, "right", JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0 );
+  if ( !lat_midi_port || !lat_audio_port[0] || !lat_audio_port[1] ) {
+    fprintf( stderr, "connie_latency: cannot register the ports\n" );
+    exit( 1 );
+  }
+  jack_set_process_callback( lat_midi_client, lat_midi_cb, NULL );
+  jack_set_process_callback( lat_audio_client, lat_audio_cb, NULL );
+  if ( jack_activate( lat_midi_client ) || jack_activate( lat_audio_client ) ) {
+    fprintf( stderr, "connie_latency: cannot activate the clients\n" );
+    exit( 1 );
+  }
+
+  // connie's ports: left, right or upper_left, upper_right (-d 2, 3)
+  char name[256];
+  snprintf( name, sizeof( name ), "%s:midi_in", connie );
+  int err = jack_connect( lat_midi_client, jack_port_name( lat_midi_port ), name );
+  jack_port_t *connie_port = NULL;
+  for ( int ch = 0; ch < 2 && !err; ch++ ) {
+    snprintf( name, sizeof( name ), "%s:%s", connie, ch ? "right" : "left" );
+    if ( !jack_port_by_name( lat_audio_client, name ) )
+      snprintf( name, sizeof( name ), "%s:upper_%s", connie, ch ? "right" : "left" );
+    if ( !ch )
+      connie_port = jack_port_by_name( lat_audio_client, name );
+    err = jack_connect( lat_audio_client, name, jack_port_name( lat_audio_port[ch] ) );
+  }
+  if ( err ) {
+    fprintf( stderr, "connie_latency: cannot connect to %s (%s)\n", connie, name );
+    exit( 1 );
+  }
+
+  jack_nframes_t rate = jack_get_sample_rate( lat_audio_client );
+  if ( !period_count )
+    periods[period_count++] = jack_get_buffer_size( lat_audio_client );
+  int *latency = malloc( notes * sizeof( int ) );
+  if ( !latency ) {
+    fprintf( stderr, "memory allocation failed\n" );
+    exit( 1 );
+  }
+  srand( 1 );
+
+  printf( "# connie_latency rate=%u threshold=%.0fdB notes=%d key=%d\n",
+          rate, 20 * log10f( lat_threshold ), notes, key );
+  printf( "# period\tpreset\tnotes\tmissed\tmin_ms\tp50_ms\tp90_ms\tp99_ms\tmax_ms\tplayback_ms\n" );
+  fflush( stdout );
+
+  for ( int p = 0; p < period_count; p++ ) {
+    if ( jack_get_buffer_size( lat_audio_client ) != (jack_nframes_t)periods[p] ) {
+      jack_set_buffer_size( lat_audio_client, periods[p] );
+      for ( int ms = 0; ms < LAT_TIMEOUT && jack_get_buffer_size( lat_audio_client ) != (jack_nframes_t)periods[p]; ms++ )
+        usleep( 1000 );
+      if ( jack_get_buffer_size( lat_audio_client ) != (jack_nframes_t)periods[p] ) {
+        fprintf( stderr, "connie_latency: period size %d not accepted\n", periods[p] );
+        continue;
+      }
+      usleep( LAT_PERIOD_SETTLE * 1000 );
+    }
+    // connie -> system playback, as far as connected
+    jack_latency_range_t playback = { 0, 0 };
+    if ( connie_port )
+      jack_port_get_latency_range( connie_port, JackPlaybackLatency, &playback );
+
+    for ( int pr = 0; pr < preset_count; pr++ ) {
+      lat_send( 1u << 31 | ( 0xC0 | ( channel - 1 ) ) << 16 | presets[pr] << 8 );
+      usleep( LAT_PRESET_SETTLE * 1000 );
+      int count = 0, missed = 0;
+      for ( int n = 0; n < notes; n++ ) {
+        if ( !lat_wait_quiet( rate ) ) {
+          missed++;
+          continue;
+        }
+        __atomic_store_n( &lat_done, 0, __ATOMIC_RELAXED );
+        // note-on at a random place in the period
+        unsigned int offset = rand() & 63;
+        lat_send( 1u << 31 | 1u << 30 | offset << 24 | ( 0x90 | ( channel - 1 ) ) << 16 | key << 8 | 100 );
+        int ms = 0;
+        while ( ms++ < LAT_TIMEOUT && !__atomic_load_n( &lat_done, __ATOMIC_ACQUIRE ) )
+          usleep( 1000 );
+        if ( __atomic_load_n( &lat_done, __ATOMIC_ACQUIRE ) )
+          latency[count++] = lat_onset - lat_sent;
+        else
+          missed++;
+        __atomic_store_n( &lat_armed, 0, __ATOMIC_RELAXED );
+        lat_send( 1u << 31 | ( 0x80 | ( channel - 1 ) ) << 16 | key << 8 );
+      }
+      printf( "%d\t%d\t%d\t%d", periods[p], presets[pr], count, missed );
+      if ( count ) {
+        qsort( latency, count, sizeof( int ), cmp_int );
+        const double ms = 1000.0 / rate;
+        printf( "\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f", latency[0] * ms, latency[count / 2] * ms,
+                latency[count * 9 / 10] * ms, latency[count * 99 / 100] * ms, latency[count - 1] * ms );
+      } else {
+        printf( "\t-\t-\t-\t-\t-" );
+      }
+      printf( "\t%.3f\n", playback.max * 1000.0 / rate );
+      fflush( stdout );
+    }
+  }
+
+  jack_client_close( lat_midi_client );
+  jack_client_close( lat_audio_client );
+  free( latency );
+  return 0;
+}
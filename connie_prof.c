@@ -0,0 +1,127 @@
+/*****************************************************************************
+ *
+ *   connie_prof.c
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "connie_prof.h"
+
+const char *prof_name[PROF_STAGES+1] = { "midi", "scan", "osc", "reverb", "clip", "total" };
+
+#ifdef CONNIE_PROFILE
+
+unsigned long long prof_start[PROF_STAGES];
+unsigned long long prof_cycles[PROF_STAGES];
+
+// written by the rt thread only
+static prof_stat_t prof_stat;
+
+static double prof_clock_hz = 0.0;
+static double prof_cycles_per_frame = 0.0;
+
+
+
+// measure the clock against CLOCK_MONOTONIC
+void prof_init( unsigned int sample_rate )
+{
+  struct timespec t0, t1;
+  clock_gettime( CLOCK_MONOTONIC, &t0 );
+  unsigned long long c0 = prof_clock();
+  usleep( 20000 );
+  clock_gettime( CLOCK_MONOTONIC, &t1 );
+  unsigned long long c1 = prof_clock();
+  double sec = ( t1.tv_sec - t0.tv_sec ) + ( t1.tv_nsec - t0.tv_nsec ) / 1e9;
+  prof_clock_hz = ( c1 - c0 ) / sec;
+  prof_set_rate( sample_rate );
+  printf( "profiling: %.1f MHz clock\n", prof_clock_hz / 1e6 );
+}
+
+
+
+// new period deadline
+void prof_set_rate( unsigned int sample_rate )
+{
+  double cycles_per_frame = prof_clock_hz / sample_rate;
+  __atomic_store( &prof_cycles_per_frame, &cycles_per_frame, __ATOMIC_RELAXED );
+}
+
+
+
+// load in per mille -> histogram bin
+static inline int prof_bin( unsigned long long cycles, unsigned long long deadline )
+{
+  unsigned long long permille = deadline ? 1000 * cycles / deadline : 0;
+  int bin = 0;
+  while ( permille && bin < PROF_BINS - 1 ) {
+    permille >>= 1;
+    bin++;
+  }
+  return bin;
+}
+
+
+// the rt thread is the only writer, relaxed stores are sufficient
+#define PROF_ADD( var, val ) __atomic_store_n( &(var), (var) + (val), __ATOMIC_RELAXED )
+
+
+
+// end of period
+void prof_period( unsigned int nframes )
+{
+  double cycles_per_frame;
+  __atomic_load( &prof_cycles_per_frame, &cycles_per_frame, __ATOMIC_RELAXED );
+  unsigned long long deadline = nframes * cycles_per_frame;
+  unsigned long long total = 0;
+
+  for ( int stage = 0; stage < PROF_STAGES; stage++ ) {
+    unsigned long long cycles = prof_cycles[stage];
+    prof_cycles[stage] = 0;
+    total += cycles;
+    PROF_ADD( prof_stat.cycles[stage], cycles );
+    PROF_ADD( prof_stat.hist[stage][ prof_bin( cycles, deadline ) ], 1 );
+  }
+  PROF_ADD( prof_stat.cycles[PROF_TOTAL], total );
+  PROF_ADD( prof_stat.hist[PROF_TOTAL][ prof_bin( total, deadline ) ], 1 );
+  PROF_ADD( prof_stat.deadline, deadline );
+  PROF_ADD( prof_stat.periods, 1 );
+}
+
+
+
+// snapshot for the ui thread
+void prof_read( prof_stat_t *stat )
+{
+  stat->periods = __atomic_load_n( &prof_stat.periods, __ATOMIC_RELAXED );
+  stat->deadline = __atomic_load_n( &prof_stat.deadline, __ATOMIC_RELAXED );
+  for ( int stage = 0; stage <= PROF_STAGES; stage++ ) {
+    stat->cycles[stage] = __atomic_load_n( &prof_stat.cycles[stage], __ATOMIC_RELAXED );
+    for ( int bin = 0; bin < PROF_BINS; bin++ )
+      stat->hist[stage][bin] = __atomic_load_n( &prof_stat.hist[stage][bin], __ATOMIC_RELAXED );
+  }
+}
+
+#endif // CONNIE_PROFILE
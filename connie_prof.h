@@ -0,0 +1,92 @@
+/*****************************************************************************
+ *
+ *   connie_prof.h
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+#ifndef CONNIE_PROF_H
+#define CONNIE_PROF_H
+
+// dsp load of the stages of the realtime callback
+// compile with -DCONNIE_PROFILE, otherwise all macros are empty
+//
+// the rt thread counts cycles per stage, at the end of each period
+// the load (cycles / period deadline) goes into log2 histograms.
+// single writer (rt thread), the ui reads with relaxed atomic loads,
+// no locks, no syscalls in the rt path
+
+enum { PROF_MIDI, PROF_SCAN, PROF_OSC, PROF_REVERB, PROF_CLIP, PROF_STAGES };
+#define PROF_TOTAL PROF_STAGES
+
+// histogram bin b: load < 2^b per mille, last bin: overload
+#define PROF_BINS 12
+
+typedef struct {
+  unsigned long long periods;                   // measured periods
+  unsigned long long deadline;                  // sum of period deadlines (cycles)
+  unsigned long long cycles[PROF_STAGES+1];     // sum of cycles per stage and total
+  unsigned long long hist[PROF_STAGES+1][PROF_BINS];
+} prof_stat_t;
+
+extern const char *prof_name[PROF_STAGES+1];
+
+#ifdef CONNIE_PROFILE
+
+#if defined( __i386__ ) || defined( __x86_64__ )
+#include <x86intrin.h>
+static inline unsigned long long prof_clock( void ) {
+  return __rdtsc();
+}
+#else
+#include <time.h>
+static inline unsigned long long prof_clock( void ) {
+  struct timespec t;
+  clock_gettime( CLOCK_MONOTONIC, &t ); // vdso, no syscall
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+#endif
+
+// cycles of the actual period, rt thread only
+extern unsigned long long prof_start[PROF_STAGES];
+extern unsigned long long prof_cycles[PROF_STAGES];
+
+#define PROF_BEGIN( stage ) ( prof_start[stage] = prof_clock() )
+#define PROF_END( stage ) ( prof_cycles[stage] += prof_clock() - prof_start[stage] )
+
+// calibrate the clock (not rt)
+extern void prof_init( unsigned int sample_rate );
+// sample rate has changed (not rt)
+extern void prof_set_rate( unsigned int sample_rate );
+// end of period, update the histograms (rt)
+extern void prof_period( unsigned int nframes );
+// copy the statistics (ui)
+extern void prof_read( prof_stat_t *stat );
+
+#else
+
+#define PROF_BEGIN( stage ) ( (void)0 )
+#define PROF_END( stage ) ( (void)0 )
+#define prof_init( sample_rate ) ( (void)0 )
+#define prof_set_rate( sample_rate ) ( (void)0 )
+#define prof_period( nframes ) ( (void)0 )
+
+#endif // CONNIE_PROFILE
+
+#endif
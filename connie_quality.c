@@ -0,0 +1,247 @@
+/*****************************************************************************
+ *
+ *   connie_quality.c
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <math.h>
+
+#include "connie.h"
+#include "connie_tg.h"
+#include "connie_ui.h"
+
+// oscillator quality check of the tonegen without jack
+// renders the same sweep of single notes and chords with both models
+// and some presets, vibrato and reverb off.
+// built three times: connie_quality with the normal tables,
+// connie_quality_ref with 65536 point tables (-DTG_CYCLE=65536) and
+// connie_quality_old with the truncating lookup of connie 1.x (-DTG_BASELINE).
+// all phases scale exactly with the table size, so the difference
+// of the normal and the reference render is the error of the table size
+// and interpolation; the old lookup gives the SNR to beat.
+// see "make quality"
+
+// the globals of connie_main.c used by the ui
+const char * connie_version = "quality";
+char *jack_name = "connie_quality";
+char *uuid = NULL;
+char *connie_conf = NULL;
+
+// keys of the single notes, held for QUALITY_NOTE seconds
+#define QUALITY_LOWKEY 24
+#define QUALITY_HIGHKEY 84
+#define QUALITY_STEP 5
+#define QUALITY_NOTE 0.1
+// chords, held for QUALITY_CHORD seconds
+#define QUALITY_CHORD 0.3
+static const int quality_chords[][4] = {
+  { 36, 40, 43, 48 }, { 60, 64, 67, 72 }, { 79, 83, 86, 91 }
+};
+#define QUALITY_CHORDS ( sizeof( quality_chords ) / sizeof( quality_chords[0] ) )
+// presets of each model
+static const int quality_presets[] = { 9, 0, 5 };
+#define QUALITY_PRESETS ( sizeof( quality_presets ) / sizeof( int ) )
+
+#define QUALITY_PERIOD 64
+
+static unsigned int quality_rate = 48000;
+
+static sample_t out_l[ QUALITY_PERIOD ];
+static sample_t out_r[ QUALITY_PERIOD ];
+static sample_t *quality_out[2] = { out_l, out_r };
+
+// the left channel of the whole render
+static float *quality_buf = NULL;
+static size_t quality_len = 0;
+static size_t quality_size = 0;
+
+
+
+// render some time and keep the left channel
+static void quality_run( double seconds ) {
+  for ( int iii = seconds * quality_rate / QUALITY_PERIOD; iii > 0; iii-- ) {
+    tg_render( quality_out, 0, QUALITY_PERIOD );
+    if ( quality_len + QUALITY_PERIOD > quality_size ) {
+      quality_size = 2 * quality_size + QUALITY_PERIOD;
+      quality_buf = realloc( quality_buf, quality_size * sizeof( float ) );
+      if ( !quality_buf ) {
+        fprintf( stderr, "memory allocation failed\n" );
+        exit( 1 );
+      }
+    }
+    for ( unsigned int frame = 0; frame < QUALITY_PERIOD; frame++ )
+      quality_buf[ quality_len++ ] = out_l[frame];
+  }
+}
+
+
+static void quality_note( int on, int key ) {
+  unsigned char event[3] = { on ? 0x90 : 0x80, key, on ? 100 : 0 };
+  tg_midi_in( event, 3 );
+}
+
+
+// the fixed sweep of all models and presets
+static void quality_render( void ) {
+  for ( int model = CONNIE; model <= HAMMOND; model++ ) {
+    connie_model = model;
+    tg_init( quality_rate );
+    tg_wait();
+    ui_setup( model, QWERTY );
+    for ( unsigned int p = 0; p < QUALITY_PRESETS; p++ ) {
+      ui_set_program( quality_presets[p] );
+      tg_vibrato = 0.0;
+      tg_reverb = 0.0;
+      tg_publish();
+      tg_wait();
+      for ( int key = QUALITY_LOWKEY; key <= QUALITY_HIGHKEY; key += QUALITY_STEP ) {
+        quality_note( 1, key );
+        quality_run( QUALITY_NOTE );
+        quality_note( 0, key );
+      }
+      for ( unsigned int c = 0; c < QUALITY_CHORDS; c++ ) {
+        for ( int k = 0; k < 4; k++ )
+          quality_note( 1, quality_chords[c][k] );
+        quality_run( QUALITY_CHORD );
+        for ( int k = 0; k < 4; k++ )
+          quality_note( 0, quality_chords[c][k] );
+      }
+      // let the last chord fade out
+      quality_run( QUALITY_CHORD );
+    } // for ( p )
+    tg_shutdown();
+  } // for ( model )
+}
+
+
+
+int main( int argc, char *argv[] ) {
+  int c;
+  const char *out_file = NULL;
+  const char *ref_file = NULL;
+  double min_snr = 0.0;
+  double old_snr = NAN;
+  int brief = 0;
+
+  while ( ( c = getopt( argc, argv, "b:c:ho:r:st:" ) ) != -1 ) {
+    switch ( c ) {
+      case 'b':
+        old_snr = atof( optarg );
+        break;
+      case 'c':
+        ref_file = optarg;
+        break;
+      case 'o':
+        out_file = optarg;
+        break;
+      case 'r':
+        quality_rate = atoi( optarg );
+        if ( quality_rate < 8000 || quality_rate > 192000 )
+          quality_rate = 48000;
+        break;
+      case 's':
+        brief = 1;
+        break;
+      case 't':
+        min_snr = atof( optarg );
+        break;
+      default:
+        printf( "usage: connie_quality [opts]\n" );
+        printf( "  -b DB\t\t\tSNR of connie_quality_old, -t DB is then the min gain over it\n" );
+        printf( "  -c REFFILE\t\tcompare with the render of connie_quality_ref, print the SNR\n" );
+        printf( "  -o OUTFILE\t\twrite the render (raw float, left channel)\n" );
+        printf( "  -r RATE\t\tsample rate, default 48000\n" );
+        printf( "  -s\t\t\tprint the SNR only\n" );
+        printf( "  -t DB\t\t\texit 1 if the SNR is below DB\n" );
+        exit( 1 );
+    }
+  }
+
+  // always fresh tables, the reference ones would be huge cache files
+  unsetenv( "XDG_CACHE_HOME" );
+  unsetenv( "HOME" );
+
+  // results to stdout, all other messages to stderr
+  FILE *out = fdopen( dup( 1 ), "w" );
+  dup2( 2, 1 );
+  if ( !out ) {
+    fprintf( stderr, "connie_quality: no output\n" );
+    exit( 1 );
+  }
+
+  quality_render();
+
+  if ( out_file ) {
+    FILE *f = fopen( out_file, "wb" );
+    if ( !f || quality_len != fwrite( quality_buf, sizeof( float ), quality_len, f ) || fclose( f ) ) {
+      fprintf( stderr, "connie_quality: cannot write %s\n", out_file );
+      exit( 1 );
+    }
+  }
+
+  int result = 0;
+  if ( ref_file ) {
+    FILE *f = fopen( ref_file, "rb" );
+    if ( !f ) {
+      fprintf( stderr, "connie_quality: cannot read %s\n", ref_file );
+      exit( 1 );
+    }
+    double signal = 0.0;
+    double noise = 0.0;
+    size_t n = 0;
+    float ref[ QUALITY_PERIOD ];
+    size_t got;
+    while ( ( got = fread( ref, sizeof( float ), QUALITY_PERIOD, f ) ) > 0 ) {
+      for ( size_t iii = 0; iii < got && n < quality_len; iii++, n++ ) {
+        double diff = quality_buf[n] - ref[iii];
+        signal += (double)ref[iii] * ref[iii];
+        noise += diff * diff;
+      }
+    }
+    fclose( f );
+    if ( n != quality_len ) {
+      fprintf( stderr, "connie_quality: %s has another length\n", ref_file );
+      exit( 1 );
+    }
+    double snr = noise > 0.0 ? 10.0 * log10( signal / noise ) : INFINITY;
+    if ( brief ) {
+      fprintf( out, "%.1f\n", snr );
+    } else if ( isnan( old_snr ) ) {
+      result = snr < min_snr;
+      fprintf( out, "%6u Hz  %5.1f dB SNR%s\n", quality_rate, snr,
+               result ? "  below the limit" : "" );
+    } else {
+      result = snr - old_snr < min_snr;
+      fprintf( out, "%6u Hz  %5.1f dB SNR  old lookup %5.1f dB  %+5.1f dB%s\n", quality_rate,
+               snr, old_snr, snr - old_snr, result ? "  below the limit" : "" );
+    }
+  }
+
+  fclose( out );
+  free( quality_buf );
+  return result;
+}
@@ -0,0 +1,215 @@
+/*****************************************************************************
+ *
+ *   connie_rawmidi.c
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "connie_rawmidi.h"
+#include "connie_fifo.h"
+
+
+// ms between the checks for rawmidi_close() and reopen tries
+#define RAWMIDI_POLL 100
+
+static const char *rawmidi_device;
+static jack_client_t *rawmidi_client;
+static int rawmidi_fd = -1;
+static pthread_t rawmidi_thread;
+static int rawmidi_running = 0;
+static int rawmidi_quit = 0;
+
+// messages reader -> rt thread
+// cmd: frame time, arg: size << 24 | status << 16 | data1 << 8 | data2
+static fifo_t rawmidi_fifo;
+
+// rt thread: start of the actual and of the last period,
+// both the same in the first one
+static jack_nframes_t rawmidi_start;
+static jack_nframes_t rawmidi_last;
+static int rawmidi_periods = 0;
+
+
+
+// one complete message (reader thread)
+static void rawmidi_put( jack_nframes_t time, const unsigned char *msg, int size )
+{
+  static int lost = 0;
+  int arg = size << 24 | msg[0] << 16 | msg[1] << 8 | ( size > 2 ? msg[2] : 0 );
+  if ( fifo_put( &rawmidi_fifo, (int)time, arg ) && !lost++ )
+    fprintf( stderr, "connie: raw midi input overflow, messages lost\n" );
+}
+
+
+
+// the reader thread
+// parses the byte stream with running status, skips sysex,
+// system common and realtime messages
+static void *rawmidi_read( void *arg )
+{
+  unsigned char msg[3];
+  int have = 0; // bytes of msg, 0: no status
+  int need = 0; // bytes of a complete message
+  while ( !__atomic_load_n( &rawmidi_quit, __ATOMIC_ACQUIRE ) ) {
+    if ( rawmidi_fd < 0 ) {
+      // a fifo may be opened before its writer
+      rawmidi_fd = open( rawmidi_device, O_RDONLY | O_NONBLOCK );
+      if ( rawmidi_fd < 0 ) {
+        usleep( RAWMIDI_POLL * 1000 );
+        continue;
+      }
+    }
+    struct pollfd pfd = { .fd = rawmidi_fd, .events = POLLIN };
+    if ( poll( &pfd, 1, RAWMIDI_POLL ) <= 0 )
+      continue;
+    unsigned char buf[256];
+    ssize_t n = read( rawmidi_fd, buf, sizeof( buf ) );
+    if ( n < 0 && ( EAGAIN == errno || EINTR == errno ) )
+      continue;
+    if ( n <= 0 ) {
+      // the fifo writer has gone or the device was unplugged: wait for the next
+      close( rawmidi_fd );
+      rawmidi_fd = -1;
+      have = 0;
+      if ( n < 0 )
+        usleep( RAWMIDI_POLL * 1000 );
+      continue;
+    }
+    jack_nframes_t time = jack_frame_time( rawmidi_client );
+    for ( ssize_t iii = 0; iii < n; iii++ ) {
+      unsigned char byte = buf[iii];
+      if ( byte >= 0xF8 ) { // realtime, can come anywhere
+        continue;
+      } else if ( byte >= 0xF0 ) { // sysex, system common: skip until next status
+        have = 0;
+      } else if ( byte & 0x80 ) { // channel message
+        msg[0] = byte;
+        have = 1;
+        need = ( 0xC0 == ( byte & 0xF0 ) || 0xD0 == ( byte & 0xF0 ) ) ? 2 : 3;
+      } else if ( have ) { // data
+        msg[have++] = byte;
+        if ( have == need ) {
+          rawmidi_put( time, msg, need );
+          have = 1; // running status
+        }
+      }
+    } // for ( iii )
+  } // while ( !quit )
+  return NULL;
+} // rawmidi_read()
+
+
+
+int rawmidi_open( const char *device, jack_client_t *client, int priority )
+{
+  if ( rawmidi_running )
+    return 0;
+  rawmidi_device = device;
+  rawmidi_client = client;
+  rawmidi_fd = open( device, O_RDONLY | O_NONBLOCK );
+  if ( rawmidi_fd < 0 ) {
+    perror( device );
+    return -1;
+  }
+  rawmidi_quit = 0;
+  for ( ;; ) {
+    pthread_attr_t attr;
+    pthread_attr_init( &attr );
+    if ( priority > 0 ) {
+      struct sched_param param = { .sched_priority = priority };
+      pthread_attr_setinheritsched( &attr, PTHREAD_EXPLICIT_SCHED );
+      pthread_attr_setschedpolicy( &attr, SCHED_FIFO );
+      pthread_attr_setschedparam( &attr, &param );
+    }
+    int err = pthread_create( &rawmidi_thread, &attr, rawmidi_read, NULL );
+    pthread_attr_destroy( &attr );
+    if ( !err )
+      break;
+    if ( priority > 0 ) {
+      fprintf( stderr, "connie: no realtime priority for the raw midi input\n" );
+      priority = 0; // again without
+      continue;
+    }
+    fprintf( stderr, "connie: cannot start the raw midi input\n" );
+    close( rawmidi_fd );
+    rawmidi_fd = -1;
+    return -1;
+  }
+  rawmidi_running = 1;
+  printf( "raw MIDI input: %s\n", device );
+  return 0;
+} // rawmidi_open()
+
+
+
+void rawmidi_close( void )
+{
+  if ( !rawmidi_running )
+    return;
+  __atomic_store_n( &rawmidi_quit, 1, __ATOMIC_RELEASE );
+  pthread_join( rawmidi_thread, NULL );
+  if ( rawmidi_fd >= 0 )
+    close( rawmidi_fd );
+  rawmidi_fd = -1;
+  rawmidi_running = 0;
+} // rawmidi_close()
+
+
+
+int rawmidi_get( jack_nframes_t start, jack_nframes_t nframes, jack_midi_event_t *event )
+{
+  // a new period, the last one started at the last start
+  // (whatever its size was)
+  if ( !rawmidi_periods || start != rawmidi_start ) {
+    rawmidi_last = rawmidi_periods ? rawmidi_start : start;
+    rawmidi_start = start;
+    rawmidi_periods = 1;
+  }
+  fifo_cmd_t msg;
+  if ( !fifo_peek( &rawmidi_fifo, &msg ) )
+    return 0;
+  // received in this period: play it in the next one
+  if ( (int)( (jack_nframes_t)msg.cmd - start ) >= 0 )
+    return 0;
+  fifo_get( &rawmidi_fifo, &msg );
+  int offset = (int)( (jack_nframes_t)msg.cmd - rawmidi_last );
+  // late (reader thread was delayed, or the first period): at once
+  if ( offset < 0 )
+    offset = 0;
+  // the last period was longer (new buffer size): at the end
+  if ( offset >= (int)nframes )
+    offset = nframes - 1;
+  event->time = offset;
+  event->size = msg.arg >> 24;
+  event->buffer[0] = msg.arg >> 16;
+  event->buffer[1] = msg.arg >> 8;
+  event->buffer[2] = msg.arg;
+  return 1;
+} // rawmidi_get()
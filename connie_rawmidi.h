@@ -0,0 +1,51 @@
+/*****************************************************************************
+ *
+ *   connie_rawmidi.h
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+#ifndef CONNIE_RAWMIDI_H
+#define CONNIE_RAWMIDI_H
+
+#include <jack/jack.h>
+#include <jack/midiport.h>
+
+// direct midi input from a raw midi device (/dev/snd/midiC1D0) or a fifo,
+// without a midi bridge between alsa and jack
+//
+// a reader thread parses the byte stream and stamps each message with the
+// jack frame time, the rt thread plays it one period later at the same
+// offset: a constant latency of one period without jitter
+
+// start the reader thread for device, stamped with the frame clock of client
+// priority: SCHED_FIFO priority of the reader, 0: normal scheduling
+// returns 0, or -1 if the device cannot be opened
+extern int rawmidi_open( const char *device, jack_client_t *client, int priority );
+
+// stop the reader thread
+extern void rawmidi_close( void );
+
+// rt thread: the next message received before the period that starts at frame
+// time start, event->time is set to its offset in the last period, limited
+// to this period of nframes; call it in each period, it keeps the start of
+// the last one. event->buffer must hold 3 bytes, returns 0 if there is none
+extern int rawmidi_get( jack_nframes_t start, jack_nframes_t nframes, jack_midi_event_t *event );
+
+#endif
@@ -0,0 +1,189 @@
+/*****************************************************************************
+ *
+ *   connie_rawmidi_test.c
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "connie_rawmidi.h"
+
+// check of the raw midi input without jack
+// the reader thread reads a fifo and stamps with the fake frame clock below,
+// the test plays the rt thread and calls rawmidi_get() for each period.
+// checks the parser (running status, sysex, realtime bytes) and the
+// offset of each message in the next period, also for the first period,
+// late messages and a new buffer size.
+// see "make rawmidi-test"
+
+// ms for the reader thread to take the bytes written
+#define TEST_WAIT 200
+
+// the frame clock of the reader thread
+static jack_nframes_t test_clock = 0;
+
+static int test_fd = -1;
+static int test_failed = 0;
+
+
+
+// replaces the jack one, connie_rawmidi.o is linked without libjack
+jack_nframes_t jack_frame_time( const jack_client_t *client )
+{
+  (void)client;
+  return __atomic_load_n( &test_clock, __ATOMIC_ACQUIRE );
+}
+
+
+
+// the bytes arrive at frame time clock
+static void test_send( jack_nframes_t clock, const unsigned char *bytes, size_t size )
+{
+  __atomic_store_n( &test_clock, clock, __ATOMIC_RELEASE );
+  if ( write( test_fd, bytes, size ) != (ssize_t)size ) {
+    perror( "connie_rawmidi_test: write" );
+    exit( 1 );
+  }
+  usleep( TEST_WAIT * 1000 );
+}
+
+
+
+// one period of the rt thread: the messages with their offsets
+// expect: size, 3 bytes and offset of each message, 0 size ends
+static void test_period( const char *name, jack_nframes_t start, jack_nframes_t nframes,
+                         const int (*expect)[5] )
+{
+  jack_midi_data_t buffer[3];
+  jack_midi_event_t event = { .buffer = buffer };
+  int ok = 1;
+  int n = 0;
+  while ( rawmidi_get( start, nframes, &event ) ) {
+    buffer[2] = event.size > 2 ? buffer[2] : 0;
+    if ( !expect[n][0] || (int)event.size != expect[n][0]
+         || buffer[0] != expect[n][1] || buffer[1] != expect[n][2] || buffer[2] != expect[n][3]
+         || (int)event.time != expect[n][4] ) {
+      printf( "  got %d bytes %02X %02X %02X at %u\n", (int)event.size,
+              buffer[0], buffer[1], buffer[2], (unsigned int)event.time );
+      ok = 0;
+    }
+    if ( expect[n][0] )
+      n++;
+  }
+  for ( ; expect[n][0]; n++ ) {
+    printf( "  missing %d bytes %02X %02X %02X at %d\n", expect[n][0],
+            expect[n][1], expect[n][2], expect[n][3], expect[n][4] );
+    ok = 0;
+  }
+  printf( "%-40s %s\n", name, ok ? "ok" : "FAILED" );
+  test_failed |= !ok;
+}
+
+
+
+int main( void )
+{
+  char dir[] = "/tmp/connie_rawmidi_XXXXXX";
+  if ( !mkdtemp( dir ) ) {
+    perror( "connie_rawmidi_test: mkdtemp" );
+    exit( 1 );
+  }
+  char fifo[ sizeof( dir ) + 8 ];
+  snprintf( fifo, sizeof( fifo ), "%s/midi", dir );
+  if ( mkfifo( fifo, 0600 ) ) {
+    perror( "connie_rawmidi_test: mkfifo" );
+    exit( 1 );
+  }
+  if ( rawmidi_open( fifo, NULL, 0 ) )
+    exit( 1 );
+  // the reader has it open, so this does not block
+  test_fd = open( fifo, O_WRONLY );
+  if ( test_fd < 0 ) {
+    perror( fifo );
+    exit( 1 );
+  }
+
+  // periods of 64 frames from 0 on
+  // before the first period: no last one, late
+  static const unsigned char first[] = { 0x90, 60, 100 };
+  static const int first_ok[][5] = { { 3, 0x90, 60, 100, 0 }, { 0 } };
+  test_send( 5, first, sizeof( first ) );
+  test_period( "first period", 64, 64, first_ok );
+
+  // running status, sysex without status after it, realtime inside
+  static const unsigned char parse[] = {
+    0x90, 62, 100, 64, 100,             // note on, running status
+    0xF0, 0x7E, 0x01, 0x02, 0xF7,       // sysex
+    67, 100,                            // no status: dropped
+    0xC0, 5,                            // program change, 2 bytes
+    0xB0, 7, 0xF8, 90,                  // cc with a clock inside
+    0xFE,                               // active sensing
+    0x80, 62, 0, 64, 0                  // note off, running status
+  };
+  static const int parse_ok[][5] = {
+    { 3, 0x90, 62, 100, 10 }, { 3, 0x90, 64, 100, 10 }, { 2, 0xC0, 5, 0, 10 },
+    { 3, 0xB0, 7, 90, 10 }, { 3, 0x80, 62, 0, 10 }, { 3, 0x80, 64, 0, 10 }, { 0 }
+  };
+  test_send( 64 + 10, parse, sizeof( parse ) );
+  test_period( "running status, sysex, realtime", 128, 64, parse_ok );
+
+  // received in the period that is rendered: in the next one
+  static const unsigned char now[] = { 0x90, 65, 1 };
+  static const int none[][5] = { { 0 } };
+  static const int now_ok[][5] = { { 3, 0x90, 65, 1, 20 }, { 0 } };
+  test_send( 192 + 20, now, sizeof( now ) );
+  test_period( "not before the next period", 192, 64, none );
+  test_period( "next period", 256, 64, now_ok );
+
+  // stamped in the last period, read after the period started: late
+  static const unsigned char late[] = { 0x80, 65, 0 };
+  static const int late_ok[][5] = { { 3, 0x80, 65, 0, 0 }, { 0 } };
+  test_period( "empty period", 320, 64, none );
+  test_send( 300, late, sizeof( late ) );
+  test_period( "late", 384, 64, late_ok );
+
+  // buffer size 64 -> 128: the offset in the 64 frame period
+  static const unsigned char grow[] = { 0x90, 70, 2 };
+  static const int grow_ok[][5] = { { 3, 0x90, 70, 2, 50 }, { 0 } };
+  test_send( 384 + 50, grow, sizeof( grow ) );
+  test_period( "new buffer size 128", 448, 128, grow_ok );
+
+  // buffer size 128 -> 32: the end of the short period
+  static const unsigned char shrink[] = { 0x80, 70, 0, 70, 0 };
+  static const int shrink_ok[][5] = { { 3, 0x80, 70, 0, 31 }, { 3, 0x80, 70, 0, 31 }, { 0 } };
+  test_send( 448 + 100, shrink, sizeof( shrink ) );
+  test_period( "new buffer size 32", 576, 32, shrink_ok );
+
+  close( test_fd );
+  rawmidi_close();
+  unlink( fifo );
+  rmdir( dir );
+  if ( test_failed )
+    printf( "raw midi test FAILED\n" );
+  return test_failed;
+}
@@ -0,0 +1,375 @@
+/*****************************************************************************
+ *
+ *   connie_render.c
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "connie.h"
+#include "connie_tg.h"
+#include "connie_ui.h"
+#include "connie_render.h"
+
+
+// render this many frames at once (like a jack period)
+#define RENDER_PERIOD 256
+
+// seconds rendered after the last event (release and reverb tail)
+#define RENDER_TAIL 2
+
+
+// one event of the midi file
+typedef struct {
+  unsigned long tick;   // absolute time in ticks
+  int seq;              // position in file, keeps the sort stable
+  long tempo;           // > 0: tempo change in us per quarter, no midi data
+  unsigned char size;
+  unsigned char data[3];
+  unsigned long frame;  // absolute time in frames
+} smf_event_t;
+
+static smf_event_t *smf_events = NULL;
+static int smf_count = 0;
+static int smf_size = 0;
+
+
+
+// append one event, grow the list if needed
+static int smf_add( unsigned long tick, long tempo, const unsigned char *data, int size ) {
+  if ( smf_count >= smf_size ) {
+    int new_size = smf_size ? 2 * smf_size : 1024;
+    smf_event_t *new_events = realloc( smf_events, new_size * sizeof( smf_event_t ) );
+    if ( !new_events ) {
+      fprintf( stderr, "memory allocation failed\n" );
+      return -1;
+    }
+    smf_events = new_events;
+    smf_size = new_size;
+  }
+  smf_event_t *ev = smf_events + smf_count;
+  ev->tick = tick;
+  ev->seq = smf_count++;
+  ev->tempo = tempo;
+  ev->size = size;
+  memcpy( ev->data, data, size );
+  ev->frame = 0;
+  return 0;
+}
+
+
+
+// big endian number of n bytes
+static unsigned long smf_get( const unsigned char *p, int n ) {
+  unsigned long value = 0;
+  while ( n-- )
+    value = ( value << 8 ) | *p++;
+  return value;
+}
+
+
+
+// variable length quantity, max. 4 bytes
+static int smf_vlq( const unsigned char **pp, const unsigned char *end, unsigned long *value ) {
+  unsigned long v = 0;
+  for ( int iii = 0; iii < 4; iii++ ) {
+    if ( *pp >= end )
+      return -1;
+    unsigned char c = *(*pp)++;
+    v = ( v << 7 ) | ( c & 0x7F );
+    if ( !( c & 0x80 ) ) {
+      *value = v;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+
+
+// read all events of one MTrk chunk
+static int smf_track( const unsigned char *p, const unsigned char *end ) {
+  unsigned long tick = 0;
+  unsigned char status = 0; // running status
+  unsigned long len;
+
+  while ( p < end ) {
+    unsigned long delta;
+    if ( smf_vlq( &p, end, &delta ) || p >= end )
+      return -1;
+    tick += delta;
+    unsigned char c = *p;
+    if ( 0xFF == c ) { // meta event: FF type len data
+      if ( p + 2 > end )
+        return -1;
+      unsigned char type = p[1];
+      p += 2;
+      if ( smf_vlq( &p, end, &len ) || len > (unsigned long)( end - p ) )
+        return -1;
+      if ( 0x51 == type && 3 == len ) { // set tempo
+        if ( smf_add( tick, smf_get( p, 3 ), NULL, 0 ) )
+          return -1;
+      } else if ( 0x2F == type ) { // end of track
+        return 0;
+      }
+      p += len;
+      status = 0;
+    } else if ( 0xF0 == c || 0xF7 == c ) { // sysex: F0 len data
+      p++;
+      if ( smf_vlq( &p, end, &len ) || len > (unsigned long)( end - p ) )
+        return -1;
+      p += len;
+      status = 0;
+    } else if ( c > 0xF0 ) { // no system messages in a file
+      return -1;
+    } else { // channel message, maybe running status
+      if ( c & 0x80 ) {
+        status = c;
+        p++;
+      } else if ( !status ) {
+        return -1;
+      }
+      // prog change and channel pressure: 1 data byte
+      int size = ( 0xC0 == ( status & 0xE0 ) ) ? 2 : 3;
+      if ( p + size - 1 > end )
+        return -1;
+      unsigned char data[3] = { status, p[0], 3 == size ? p[1] : 0 };
+      p += size - 1;
+      if ( smf_add( tick, 0, data, size ) )
+        return -1;
+    }
+  } // while ( p < end )
+  return 0;
+}
+
+
+
+// sort by time, keep file order for equal times
+static int smf_cmp( const void *a, const void *b ) {
+  const smf_event_t *ea = a;
+  const smf_event_t *eb = b;
+  if ( ea->tick != eb->tick )
+    return ea->tick < eb->tick ? -1 : 1;
+  return ea->seq - eb->seq;
+}
+
+
+
+// read the file, merge all tracks and calculate the frame of each event
+static int smf_read( const char *midi_file, unsigned int rate ) {
+  FILE *f = fopen( midi_file, "rb" );
+  if ( !f ) {
+    perror( midi_file );
+    return -1;
+  }
+  fseek( f, 0, SEEK_END );
+  long file_size = ftell( f );
+  fseek( f, 0, SEEK_SET );
+  unsigned char *buf = malloc( file_size > 0 ? file_size : 1 );
+  if ( !buf || fread( buf, 1, file_size, f ) != (size_t)file_size ) {
+    fprintf( stderr, "%s: read error\n", midi_file );
+    fclose( f );
+    free( buf );
+    return -1;
+  }
+  fclose( f );
+
+  const unsigned char *p = buf;
+  const unsigned char *end = buf + file_size;
+  if ( file_size < 14 || memcmp( p, "MThd", 4 ) || smf_get( p + 4, 4 ) < 6 ) {
+    fprintf( stderr, "%s: not a standard midi file\n", midi_file );
+    free( buf );
+    return -1;
+  }
+  int tracks = smf_get( p + 10, 2 );
+  unsigned int division = smf_get( p + 12, 2 );
+  p += 8 + smf_get( p + 4, 4 );
+
+  for ( int track = 0; track < tracks && p + 8 <= end; track++ ) {
+    unsigned long len = smf_get( p + 4, 4 );
+    if ( len > (unsigned long)( end - p - 8 ) ) {
+      fprintf( stderr, "%s: track %d truncated\n", midi_file, track );
+      free( buf );
+      return -1;
+    }
+    if ( !memcmp( p, "MTrk", 4 ) && smf_track( p + 8, p + 8 + len ) ) {
+      fprintf( stderr, "%s: track %d corrupt\n", midi_file, track );
+      free( buf );
+      return -1;
+    }
+    p += 8 + len; // skip unknown chunks
+  }
+  free( buf );
+
+  qsort( smf_events, smf_count, sizeof( smf_event_t ), smf_cmp );
+
+  // ticks -> seconds -> frames
+  double sec_per_tick;
+  long tempo = 500000; // 120 bpm
+  if ( division & 0x8000 ) { // smpte: -fps, ticks per frame
+    int fps = -(signed char)( division >> 8 );
+    sec_per_tick = 1.0 / ( ( 29 == fps ? 29.97 : fps ) * ( division & 0xFF ) );
+    tempo = 0;
+  } else {
+    sec_per_tick = tempo / 1e6 / division;
+  }
+  double sec = 0.0;
+  unsigned long tick = 0;
+  for ( int iii = 0; iii < smf_count; iii++ ) {
+    smf_event_t *ev = smf_events + iii;
+    sec += ( ev->tick - tick ) * sec_per_tick;
+    tick = ev->tick;
+    ev->frame = sec * rate + 0.5;
+    if ( ev->tempo && tempo ) // tempo is ignored for smpte time
+      sec_per_tick = ev->tempo / 1e6 / division;
+  }
+  return 0;
+}
+
+
+
+// little endian value of n bytes
+static void wav_put( FILE *f, uint32_t value, int n ) {
+  while ( n-- ) {
+    fputc( value & 0xFF, f );
+    value >>= 8;
+  }
+}
+
+
+
+// RIFF WAVE header for 32 bit float stereo
+static void wav_header( FILE *f, unsigned int rate, uint32_t frames ) {
+  uint32_t data = frames * 2 * sizeof( float );
+  fwrite( "RIFF", 1, 4, f );
+  wav_put( f, 4 + 26 + 12 + 8 + data, 4 );
+  fwrite( "WAVE", 1, 4, f );
+  fwrite( "fmt ", 1, 4, f );
+  wav_put( f, 18, 4 );
+  wav_put( f, 3, 2 ); // WAVE_FORMAT_IEEE_FLOAT
+  wav_put( f, 2, 2 ); // channels
+  wav_put( f, rate, 4 );
+  wav_put( f, rate * 2 * sizeof( float ), 4 );
+  wav_put( f, 2 * sizeof( float ), 2 ); // block align
+  wav_put( f, 32, 2 ); // bits
+  wav_put( f, 0, 2 ); // no extension
+  fwrite( "fact", 1, 4, f );
+  wav_put( f, 4, 4 );
+  wav_put( f, frames, 4 );
+  fwrite( "data", 1, 4, f );
+  wav_put( f, data, 4 );
+}
+
+
+
+//
+// render the file with the same path as rt_process_cb()
+// as fast as possible
+//
+int render_smf( const char *midi_file, const char *wav_file ) {
+  const unsigned int rate = tg_sample_rate;
+
+  smf_count = 0;
+  if ( smf_read( midi_file, rate ) )
+    return 1;
+
+  FILE *wav = fopen( wav_file, "wb" );
+  if ( !wav ) {
+    perror( wav_file );
+    return 1;
+  }
+
+  unsigned long last = smf_count ? smf_events[smf_count-1].frame : 0;
+  unsigned long frames = last + RENDER_TAIL * rate;
+  wav_header( wav, rate, frames );
+
+  struct timespec t_start, t_end;
+  clock_gettime( CLOCK_MONOTONIC, &t_start );
+
+  // left and right of each division, mixed into one file
+  sample_t div_out[2*TG_DIVISIONS][RENDER_PERIOD];
+  sample_t *out_div[2*TG_DIVISIONS];
+  for ( int port = 0; port < 2 * TG_DIVISIONS; port++ )
+    out_div[port] = div_out[port];
+  float out[2*RENDER_PERIOD];
+  int event = 0;
+
+  for ( unsigned long pos = 0; pos < frames; pos += RENDER_PERIOD ) {
+    unsigned int nframes = frames - pos < RENDER_PERIOD ? frames - pos : RENDER_PERIOD;
+    unsigned int done = 0;
+    // render up to the time stamp of each midi event, then process the event
+    while ( event < smf_count && smf_events[event].frame < pos + nframes ) {
+      smf_event_t *ev = smf_events + event++;
+      if ( ev->tempo )
+        continue;
+      unsigned int time = ev->frame - pos;
+      if ( time > done ) {
+        tg_render( out_div, done, time - done );
+        done = time;
+      }
+      tg_midi_in( ev->data, ev->size );
+      // program change and tuning like the ui does
+      // wait for the tables to get the same result each time
+      int cmd, arg;
+      while ( tg_get_cmd( &cmd, &arg ) ) {
+        ui_command( cmd, arg );
+        tg_wait();
+      }
+    }
+    // the rest of the period
+    tg_render( out_div, done, nframes - done );
+
+    for ( unsigned int frame = 0; frame < nframes; frame++ ) {
+      out[2*frame] = div_out[0][frame];
+      out[2*frame+1] = div_out[1][frame];
+    }
+    for ( int div = 1; div < tg_divisions; div++ ) {
+      for ( unsigned int frame = 0; frame < nframes; frame++ ) {
+        out[2*frame] += div_out[2*div][frame];
+        out[2*frame+1] += div_out[2*div+1][frame];
+      }
+    }
+    fwrite( out, sizeof( float ), 2 * nframes, wav );
+  }
+
+  clock_gettime( CLOCK_MONOTONIC, &t_end );
+  int result = ferror( wav );
+  if ( fclose( wav ) || result ) {
+    perror( wav_file );
+    return 1;
+  }
+
+  double wall = ( t_end.tv_sec - t_start.tv_sec ) + ( t_end.tv_nsec - t_start.tv_nsec ) / 1e9;
+  double audio = (double)frames / rate;
+  printf( "rendered %d events, %.1f s audio in %.2f s (%.1f x realtime)\n",
+          smf_count, audio, wall, wall > 0 ? audio / wall : 0.0 );
+
+  free( smf_events );
+  smf_events = NULL;
+  smf_count = smf_size = 0;
+  return 0;
+}
@@ -0,0 +1,171 @@
+/*****************************************************************************
+ *
+ *   connie_screen.c
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "connie_screen.h"
+
+
+typedef struct {
+  char ch[4]; // utf-8, one column
+  int color;
+} screen_cell_t;
+
+// next: the frame being drawn, shown: the frame on the terminal
+static screen_cell_t screen_next[SCREEN_ROWS][SCREEN_COLS];
+static screen_cell_t screen_shown[SCREEN_ROWS][SCREEN_COLS];
+// rows of the last frame with text, the cursor waits below
+static int screen_rows = 0;
+static int screen_next_rows = 0;
+
+// enough for every cell with cursor move and color
+static char screen_buf[SCREEN_ROWS * SCREEN_COLS * 24];
+static int screen_len;
+
+
+
+static void screen_blank( screen_cell_t ( *cells )[SCREEN_COLS] ) {
+  for ( int row = 0; row < SCREEN_ROWS; row++ )
+    for ( int col = 0; col < SCREEN_COLS; col++ )
+      cells[row][col] = (screen_cell_t){ { ' ' }, 0 };
+}
+
+
+
+static void screen_add( const char *fmt, ... ) {
+  va_list ap;
+  va_start( ap, fmt );
+  screen_len += vsnprintf( screen_buf + screen_len, sizeof( screen_buf ) - screen_len, fmt, ap );
+  va_end( ap );
+}
+
+
+
+// the buffer in one write (more only if the terminal takes less)
+static void screen_write( void ) {
+  const char *buf = screen_buf;
+  while ( screen_len > 0 ) {
+    ssize_t n = write( STDOUT_FILENO, buf, screen_len );
+    if ( n < 0 && EINTR == errno )
+      continue;
+    if ( n <= 0 )
+      break;
+    buf += n;
+    screen_len -= n;
+  }
+  screen_len = 0;
+}
+
+
+
+void screen_init( void ) {
+  fflush( stdout ); // the start messages first
+  screen_blank( screen_next );
+  screen_next_rows = 0;
+  screen_flush( 1 );
+  screen_add( "\e[?25l" );
+  screen_write();
+}
+
+
+
+void screen_exit( void ) {
+  screen_add( "\e[0m\e[%d;1H\e[?25h", screen_rows + 1 );
+  screen_write();
+}
+
+
+
+void screen_begin( void ) {
+  screen_blank( screen_next );
+  screen_next_rows = 0;
+}
+
+
+
+int screen_print( int row, int col, int color, const char *fmt, ... ) {
+  char text[4 * SCREEN_COLS];
+  va_list ap;
+  va_start( ap, fmt );
+  vsnprintf( text, sizeof( text ), fmt, ap );
+  va_end( ap );
+  if ( row < 0 || row >= SCREEN_ROWS )
+    return col;
+  if ( row >= screen_next_rows )
+    screen_next_rows = row + 1;
+  for ( const unsigned char *t = (const unsigned char *)text; *t && col < SCREEN_COLS; ) {
+    if ( '\t' == *t ) {
+      col = ( col + 8 ) & ~7;
+      t++;
+      continue;
+    }
+    // the bytes of one utf-8 character
+    int len = *t < 0xC0 ? 1 : *t < 0xE0 ? 2 : *t < 0xF0 ? 3 : 4;
+    screen_cell_t *cell = &screen_next[row][col++];
+    memset( cell->ch, 0, sizeof( cell->ch ) );
+    for ( int i = 0; i < len && *t; i++ )
+      cell->ch[i] = *t++;
+    cell->color = color;
+  }
+  return col < SCREEN_COLS ? col : SCREEN_COLS;
+}
+
+
+
+void screen_flush( int full ) {
+  if ( full ) {
+    screen_add( "\e[0m\e[H\e[2J" );
+    screen_blank( screen_shown );
+  }
+  int color = full ? 0 : -1; // unknown
+  int at_row = -1, at_col = -1; // cursor
+  for ( int row = 0; row < SCREEN_ROWS; row++ ) {
+    for ( int col = 0; col < SCREEN_COLS; col++ ) {
+      const screen_cell_t *cell = &screen_next[row][col];
+      if ( !memcmp( cell, &screen_shown[row][col], sizeof( *cell ) ) )
+        continue;
+      if ( row != at_row || col != at_col )
+        screen_add( "\e[%d;%dH", row + 1, col + 1 );
+      if ( cell->color != color )
+        screen_add( "\e[%dm", color = cell->color );
+      screen_add( "%.4s", cell->ch );
+      screen_shown[row][col] = *cell;
+      at_row = row;
+      at_col = col + 1;
+    }
+  }
+  if ( color > 0 )
+    screen_add( "\e[0m" );
+  // park the cursor below, where other output goes
+  screen_rows = screen_next_rows;
+  if ( at_row >= 0 || full )
+    screen_add( "\e[%d;1H", screen_rows + 1 );
+  screen_write();
+}
@@ -0,0 +1,49 @@
+/*****************************************************************************
+ *
+ *   connie_screen.h
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+#ifndef CONNIE_SCREEN_H
+#define CONNIE_SCREEN_H
+
+// the terminal as a grid of cells
+//
+// each frame is drawn from scratch into the grid, screen_flush()
+// compares it with the frame on the terminal and writes only the
+// changed cells, with cursor addressing, in one write()
+
+#define SCREEN_ROWS 40
+#define SCREEN_COLS 100
+
+// clear the terminal, hide the cursor
+extern void screen_init( void );
+// cursor below the last frame, visible again
+extern void screen_exit( void );
+// start a new frame, all cells blank
+extern void screen_begin( void );
+// text at row, col (0..), ANSI color (0: default), tabs every 8 columns,
+// clipped at the grid border, returns the column after the text
+extern int screen_print( int row, int col, int color, const char *fmt, ... )
+  __attribute__ ((format (printf, 4, 5)));
+// show the frame, full: repaint the whole terminal (after foreign output)
+extern void screen_flush( int full );
+
+#endif
@@ -0,0 +1,1975 @@
+/*****************************************************************************
+ *
+ *   connie_tg.c
+ *
+ *   Simulation of an electronic organ like Vox Continental
+ *   with JACK MIDI input and JACK audio output
+ *
+ *   Copyright (C) 2009,2010 Martin Homuth-Rosemann
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; version 2 of the License
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301 USA.
+ *
+ ******************************************************************************/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#if defined( __AVX2__ )
+#include <immintrin.h>
+#elif defined( __SSE2__ )
+#include <emmintrin.h>
+#elif defined( __SSE__ )
+#include <xmmintrin.h>
+#endif
+
+#include "connie.h"
+#include "connie_tg.h"
+#include "connie_fifo.h"
+#include "connie_cache.h"
+#include "connie_prof.h"
+#include "reverb.h"
+#include "scales.h"
+
+
+//////////////////////////////////////////////
+//            <USER TUNABLE PART>           //
+//////////////////////////////////////////////
+//
+// "size of the instrument"
+#define OCTAVES 5
+#define LOWNOTE 24
+#define HIGHNOTE (LOWNOTE+12*OCTAVES)
+
+// max "leslie" rotation freq (8 steps)
+#define VIBRATO 6.4
+//
+//////////////////////////////////////////////
+//           </USER TUNABLE PART>           //
+//////////////////////////////////////////////
+
+
+
+// ***********************************************
+// tonegen
+// ***********************************************
+
+
+#define MIDI_MAX 128
+#define OCT_SAMP (OCTAVES+2)
+#define OCT_MIX (OCTAVES+3)
+#define NOTE_MAX (LOWNOTE+12*OCT_MIX)
+#define MAX_HARMONIC (1<<(OCT_SAMP-1))
+
+// half tone steps
+#define OCT 12
+#define FIFTH 7
+#define THIRD 4
+
+// samples in one cycle of each table, the same at all sample rates
+// up to TG_CYCLE_RATE, twice as many above (the partials of the low notes
+// and the interpolation error need them there)
+// power of 2 for the fft and the index mask, read with linear interpolation
+// each sample is stored with the slope to the next one (one load per frame)
+// 15 tables of 16 KiB (32 KiB above TG_CYCLE_RATE) stay in the cache while mixing
+// (connie_quality_ref builds with 65536 point reference tables,
+// connie_quality_old with TG_BASELINE emulates the lookup of connie 1.x)
+#ifndef TG_CYCLE
+#define TG_CYCLE 2048
+#endif
+#define TG_CYCLE_RATE 96000
+#define TG_CYCLE_MAX ( 2 * TG_CYCLE )
+
+// max frames per block, control data is updated at block start
+#define TG_BLOCK 32
+
+
+// one halftone step
+const float tg_halftone = 1.059463094;
+
+// the intonation
+// intonation, concert_pitch and transpose are set by the ui
+// and reach the rt thread with tg_publish()
+int intonation = 0; // default
+
+// tune the instrument
+float concert_pitch = 440.0;
+int transpose = 0;
+const char *inton_name;
+
+// type of instrument
+model_t connie_model = CONNIE;
+
+
+// the current sample rate
+unsigned int tg_sample_rate;
+
+
+// all tables that depend on the sample rate
+// built outside the rt thread, swapped in at a block start
+typedef struct {
+  unsigned int serial; // counts up with each new set, never 0
+  unsigned int sample_rate;
+  // write a newly built set into the cache
+  int store;
+  // samples in cycle (TG_CYCLE or TG_CYCLE_MAX, also part of the cache key)
+  unsigned int size;
+  // one cycle of our sound for diff voices (malloc'ed)
+  // all tables are size pairs of sample and slope, see tg_pairs()
+  sample_t *fl;
+  // reed and sharp, one block with 2 * OCT_SAMP tables (malloc'ed or mmap'ed)
+  // point to the flute until the worker threads have built them
+  // written by the workers, read by the rt thread with atomic load
+  const sample_t *rd[ OCT_SAMP ];
+  const sample_t *sh[ OCT_SAMP ];
+  sample_t *mem;
+  const sample_t *map;
+  cache_key_t key;
+  // worker threads building the reed and sharp octaves
+  pthread_t worker[ OCT_SAMP ];
+  int workers;
+  int next; // next octave to build
+  int left; // octaves not yet built
+} tg_tables_t;
+
+// the set in use (rt thread)
+static tg_tables_t *tg_tables = NULL;
+// a new set, taken by the rt thread at the next block
+static tg_tables_t *tg_tables_next = NULL;
+// the set replaced by the rt thread, freed by the ui thread
+// the rt thread takes no new set before the old one is gone
+static tg_tables_t *tg_tables_old = NULL;
+// the newest set, in use, next or still being built (not rt)
+static tg_tables_t *tg_tables_latest = NULL;
+// the latest set is still being built, not yet handed to the rt thread
+static int tg_tables_building = 0;
+static unsigned int tg_tables_serial = 0;
+// sample rate and tuning of the latest set (not rt)
+static unsigned int tg_tables_rate = 0;
+static float tg_tables_pitch;
+static int tg_tables_inton;
+// tg_set_rate() (jack thread) and tg_publish() (ui thread)
+static pthread_mutex_t tg_tables_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// version of the reed and sharp tables in the cache
+#define TG_CACHE_VERSION 4
+#if OCT_SAMP > CACHE_OCTAVES
+#error "more octaves than the cache key holds"
+#endif
+
+// the rt copy of the active set
+static const sample_t *tg_cycle_fl;
+static const sample_t **tg_cycle_rd;
+static const sample_t **tg_cycle_sh;
+// samples in one cycle of the active set
+static unsigned int tg_cycle = TG_CYCLE;
+// table samples per frame at 1 Hz
+static float tg_cy_per_frame;
+// frames per key scan tick - 1
+static unsigned int tg_scan_frames;
+
+// frequency of each midi note for each scale at 440 Hz (malloc'ed)
+static float (*tg_scale_freq)[MIDI_MAX] = NULL;
+
+// sample offset of each tone, advanced by rt_process
+static float tg_sample_offset[12];
+// sample offset increment of each tone per frame (incl. vibrato, pitch)
+static float tg_sample_inc[12];
+
+// actual vibrato shift -1..1, updated each block
+static float tg_shift = 0.0;
+// and its offset in the flute table
+static float tg_shift_offset = 0.f;
+
+// reverb type in use, 0: jcrev
+static int tg_fdn_lines = 0;
+// and the sample rate it was set up for
+static unsigned int tg_reverb_rate = 0;
+
+
+// flute, reed and sharp of each octave premixed with the voice
+// volumes of a division, the kernel reads one table instead of
+// three (two instead of five at the octave borders)
+// built outside the rt thread when the drawbars change or the tables
+// are complete, double buffered: the rt thread uses one, the other
+// one is built and handed over like the table sets
+typedef struct {
+  unsigned int serial; // of the table set, 0: empty
+  float vol_fl;
+  float vol_rd;
+  float vol_sh;
+} tg_premix_key_t;
+
+typedef struct {
+  tg_premix_key_t key;
+  sample_t cycle[ OCT_SAMP ][ 2 * TG_CYCLE_MAX ];
+} tg_premix_t;
+
+// two for each division (malloc'ed)
+static tg_premix_t *tg_premix_mem = NULL;
+// built and not yet taken by the rt thread
+static tg_premix_t *tg_premix_next[TG_DIVISIONS];
+// given back by the rt thread
+static tg_premix_t *tg_premix_free[TG_DIVISIONS];
+// the last one built for each division (not rt)
+static tg_premix_key_t tg_premix_done[TG_DIVISIONS];
+
+// one division, a manual or the pedalboard (rt thread)
+// the tables and the phases above are shared by all divisions
+typedef struct {
+  // actual volume of each key
+  int vol_raw[MIDI_MAX]; // from key press/release
+  int vol_smooth[MIDI_MAX]; // ramped volume
+  int vol_key[MIDI_MAX]; // key volume
+  // the midi note of each pressed key (transpose may change meanwhile)
+  unsigned char note_of_key[MIDI_MAX];
+  // the keys pressed or still sounding (vol_smooth > 0)
+  int key_list[MIDI_MAX];
+  int keys;
+  char key_on[MIDI_MAX];
+  // the keys of the list above with vol_smooth != vol_raw
+  // only these change their vol_key at the next key scan
+  int ramp_list[MIDI_MAX];
+  int ramps;
+  char ramp_on[MIDI_MAX];
+  // volume of each note after stops mixing, the sum of
+  // vol_key * stop volume of all keys (truncated each)
+  // maybe > MIDI_MAX!
+  int vol_note[NOTE_MAX];
+  // the notes with vol_note != 0 after the last key scan
+  int note_list[NOTE_MAX];
+  int notes;
+  char note_on[NOTE_MAX];
+  // the stop volumes vol_note is mixed with
+  float vol_stop[9];
+  // mix all keys again at the next key scan
+  int restack;
+  // midi volume (cc 7)
+  float master_vol;
+  // the voices used with the actual model and drawbars, or TG_MIX
+  int voice_mask;
+  // the premixed voices in use
+  tg_premix_t *premix;
+  // the reverb of the mix, mono or stereo
+  reverb_t rev;
+  fdn_t fdn;
+  sample_t wet[TG_BLOCK];
+  sample_t wet_r[TG_BLOCK];
+} tg_div_t;
+
+static tg_div_t tg_div[TG_DIVISIONS];
+// the mono mix of all notes of each division for one block
+static sample_t tg_mix[TG_DIVISIONS][TG_BLOCK];
+
+// the sounding notes of all divisions, division << 8 | note
+// rebuilt at each key scan, mixed by tg_osc_notes()
+static int tg_play_list[TG_DIVISIONS*NOTE_MAX];
+static int tg_plays = 0;
+
+// note offset of each stop relative to the key (16' .. 1')
+static const int tg_stop_offset[9] = {
+  -OCT, FIFTH, 0, OCT, OCT + FIFTH, OCT + OCT, OCT + OCT + THIRD, OCT + OCT + FIFTH, OCT + OCT + OCT
+};
+
+// actual value of each midi control
+int midi_cc[128];
+
+// the midi pitch - 2000
+int midi_pitch = 0;
+
+// the actual midi prog
+int midi_prog = 0;
+
+// the divisions, fixed at tg_init()
+int tg_divisions = 1;
+int tg_div_channel[TG_DIVISIONS] = { 0, 2, 3 };
+int tg_div_low[TG_DIVISIONS] = { 0, 0, 0 };
+int tg_div_high[TG_DIVISIONS] = { 127, 127, 127 };
+
+const char *tg_div_name( int division )
+{
+  static const char *name[TG_DIVISIONS] = { "upper", "lower", "pedal" };
+  return name[division];
+}
+
+// the ui side of the parameters, published by tg_publish()
+// the rt thread only reads the snapshot tg_p
+//
+// the division of the values below
+int tg_division = 0;
+
+// vibrato frequency
+float tg_vibrato   = 0;
+// percussion intensity
+float tg_percussion = 0;
+// reverb intensity
+float tg_reverb = 0;
+
+// reverb type: 0 = mono jcrev, 4, 8, 16 = stereo fdn with that many lines
+int tg_reverb_lines = 0;
+
+// stops
+float tg_vol[9] = { 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+// voices
+float tg_vol_fl  = 0;
+float tg_vol_rd  = 0;
+float tg_vol_sh  = 0;
+
+// master volume
+float tg_master_vol = 0.25;
+
+// midi channel 1..16, or 0=all
+int tg_midi_channel = 0;
+
+
+#define VOL_RAW_MAX 1000
+static int soft_step[ 2 * VOL_RAW_MAX + 1 ];
+
+
+// parameter snapshot, triple buffered
+// ui: writes tg_param[ tg_param_back ], then swaps it with tg_param_mid
+// rt: at block start swaps tg_param_mid with its front buffer if fresh
+// no locks, each side owns one buffer, the third one is in transit
+typedef struct {
+  float vol[9];
+  float vol_fl;
+  float vol_rd;
+  float vol_sh;
+  float percussion;
+  float vibrato;
+  float reverb;
+} tg_div_param_t;
+
+typedef struct {
+  int intonation;
+  float concert_pitch;
+  int transpose;
+  float vibrato; // fastest of the divisions
+  int reverb_lines;
+  tg_div_param_t div[TG_DIVISIONS];
+} tg_param_t;
+
+// the published values of each division (ui only)
+static tg_div_param_t tg_div_ui[TG_DIVISIONS];
+
+#define TG_PARAM_FRESH 4
+static tg_param_t tg_param[3];
+static int tg_param_back = 0; // ui only
+static int tg_param_mid = 1;  // shared, index | TG_PARAM_FRESH
+static int tg_param_front = 2; // rt only
+static const tg_param_t *tg_p = tg_param + 2;
+
+// commands ui -> rt and rt -> ui
+static fifo_t tg_cmd_in;
+static fifo_t tg_cmd_out;
+
+// eventfd of tg_notify(), -1: the ui polls
+static int tg_notify_fd = -1;
+
+
+
+static void tg_tables_update( unsigned int sample_rate, float pitch, int inton, int store );
+static void tg_premix_update( void );
+
+// publish the ui values (ui thread)
+void tg_publish( void ) {
+  tg_div_param_t *d = tg_div_ui + tg_division;
+  for ( int stop = 0; stop < 9; stop++ )
+    d->vol[stop] = tg_vol[stop];
+  d->vol_fl = tg_vol_fl;
+  d->vol_rd = tg_vol_rd;
+  d->vol_sh = tg_vol_sh;
+  d->percussion = tg_percussion;
+  d->vibrato = tg_vibrato;
+  d->reverb = tg_reverb;
+
+  tg_param_t *p = tg_param + tg_param_back;
+  p->intonation = intonation;
+  p->concert_pitch = concert_pitch;
+  p->transpose = transpose;
+  p->reverb_lines = tg_reverb_lines;
+  p->vibrato = 0;
+  for ( int div = 0; div < tg_divisions; div++ ) {
+    p->div[div] = tg_div_ui[div];
+    if ( p->vibrato < tg_div_ui[div].vibrato )
+      p->vibrato = tg_div_ui[div].vibrato;
+  }
+  tg_param_back = __atomic_exchange_n( &tg_param_mid, tg_param_back | TG_PARAM_FRESH,
+                                       __ATOMIC_ACQ_REL ) & 3;
+  // the reed and sharp partials follow the tuning
+  // the cache keeps only the tunings the organ starts with
+  tg_tables_update( tg_sample_rate, concert_pitch, intonation, 0 );
+  // and the premixed voices the drawbars
+  tg_premix_update();
+}
+
+
+
+// take the latest snapshot (rt thread, block start)
+static void tg_fetch( void ) {
+  if ( __atomic_load_n( &tg_param_mid, __ATOMIC_RELAXED ) & TG_PARAM_FRESH ) {
+    tg_param_front = __atomic_exchange_n( &tg_param_mid, tg_param_front,
+                                          __ATOMIC_ACQ_REL ) & 3;
+    tg_p = tg_param + tg_param_front;
+  }
+}
+
+
+
+// denormals are slow: flush them to zero in this thread
+// the mxcsr (fpcr) is per thread, called by the rt thread at its first
+// block and by every worker thread. x87 math is not affected, see reverb.c
+static void tg_ftz( void ) {
+#if defined( __SSE__ )
+  unsigned int csr = _mm_getcsr() | 0x8000; // flush to zero
+#if defined( __x86_64__ )
+  csr |= 0x0040; // denormals are zero (not on all 32 bit cpus)
+#endif
+  _mm_setcsr( csr );
+#elif defined( __aarch64__ )
+  unsigned long fpcr;
+  __asm__ __volatile__ ( "mrs %0, fpcr" : "=r" ( fpcr ) );
+  fpcr |= 1UL << 24; // FZ
+  __asm__ __volatile__ ( "msr fpcr, %0" : : "r" ( fpcr ) );
+#endif
+}
+
+
+
+// all sound off (rt thread)
+static void tg_key_ramp( tg_div_t *div, int key );
+
+static void tg_do_panic( tg_div_t *div ) {
+  for ( int iii = 0; iii < MIDI_MAX; iii++ )
+    div->vol_key[iii] = div->vol_raw[iii] = 0;
+  for ( int iii = 0; iii < NOTE_MAX; iii++ )
+    div->vol_note[iii] = 0;
+  // the sounding keys ramp down from here
+  for ( int iii = 0; iii < div->keys; iii++ )
+    tg_key_ramp( div, div->key_list[iii] );
+  div->restack = 1;
+}
+
+
+
+// all sound off (ui thread), done at the next block
+void tg_panic( void ) {
+  fifo_put( &tg_cmd_in, TG_CMD_PANIC, 0 );
+}
+
+
+
+// commands from the rt thread (ui thread)
+int tg_get_cmd( int *cmd, int *arg ) {
+  fifo_cmd_t c;
+  if ( !fifo_get( &tg_cmd_out, &c ) )
+    return 0;
+  *cmd = c.cmd;
+  *arg = c.arg;
+  return 1;
+}
+
+
+
+void tg_notify( int fd ) {
+  __atomic_store_n( &tg_notify_fd, fd, __ATOMIC_RELEASE );
+}
+
+
+
+// wake up the ui (table workers, jack session, not the rt thread)
+// only for rare events, an eventfd write never blocks
+void tg_wake( void ) {
+  int fd = __atomic_load_n( &tg_notify_fd, __ATOMIC_ACQUIRE );
+  if ( fd >= 0 ) {
+    const uint64_t one = 1;
+    ssize_t written = write( fd, &one, sizeof( one ) );
+    (void)written; // counter full: the ui is awake anyway
+  }
+}
+
+
+
+// commands from the ui thread (rt thread, block start)
+static void tg_do_cmd( void ) {
+  fifo_cmd_t c;
+  while ( fifo_get( &tg_cmd_in, &c ) ) {
+    switch ( c.cmd ) {
+      case TG_CMD_PANIC:
+        for ( int div = 0; div < tg_divisions; div++ )
+          tg_do_panic( tg_div + div );
+        break;
+    }
+  }
+}
+
+
+
+// soft clipping f(x) = x - 1/3 * x^3
+static sample_t clip( sample_t sample ) {
+  if ( sample > 1.0 )
+    sample = 2.0/3.0;
+  else if ( sample < -1.0 )
+    sample = -2.0/3.0;
+  else sample = sample - ( sample * sample * sample ) / 3.0;
+  return sample;
+}
+
+
+
+// one sounding note of the oscillator bank:
+// up to five tables (flute, 2*reed, 2*sharp) read at the same position
+typedef struct {
+  const sample_t *table[5];
+  float weight[5];
+  int mult; // 1<<octave
+} tg_voice_t;
+
+
+// the voices used with the actual model and drawbars
+#define TG_FL 1
+#define TG_RD 2
+#define TG_SH 4
+// all of them from the premixed tables of the division
+#define TG_MIX 8
+
+
+
+// prepare the tables and weights of a tone in this octave
+// mixes the flute, reed and sharp voices of the division with the volumes of p
+// done once per note and block, the kernel below does the frames
+// returns 1 if the note crossfades between two octave tables
+//
+static int tg_voice( tg_voice_t *voice, unsigned int tone, unsigned int octave, float vol,
+                     const tg_div_t *div, const tg_div_param_t *p ) {
+  const int mask = div->voice_mask;
+  float foldback_damp = 1.f;
+  // "normalize" the tone
+  while ( tone >= 12 ) {
+    tone -= 12;
+    octave++;
+  }
+  // octave foldback, damp the resulting sample (?)
+  while ( octave >= OCT_SAMP ) {
+    octave--;
+    foldback_damp *= 1.5;
+  }
+  voice->mult = 1 << octave;
+  vol /= foldback_damp;
+
+  int n = 0;
+  int xfade = 0;
+  // premixed, crossfade as reed and sharp below
+  // the flute weights add up to vol
+  if ( TG_MIX == mask ) {
+    sample_t (*cycle)[ 2 * TG_CYCLE_MAX ] = div->premix->cycle;
+    if ( octave > 0  && tone < 4 ) {
+      voice->table[n] = cycle[octave-1];
+      voice->weight[n++] = (4-tone) * vol / 8;
+      voice->table[n] = cycle[octave];
+      voice->weight[n++] = (4+tone) * vol / 8;
+      xfade = 1;
+    } else if ( octave < OCT_SAMP-1  && tone > 7 ) {
+      voice->table[n] = cycle[octave];
+      voice->weight[n++] = (11+4-tone) * vol / 8;
+      voice->table[n] = cycle[octave+1];
+      voice->weight[n++] = (tone-(11-4)) * vol / 8;
+      xfade = 1;
+    } else {
+      voice->table[n] = cycle[octave];
+      voice->weight[n++] = vol;
+    }
+    return xfade;
+  }
+
+  // flute voice uses sine wave, no average needed
+  if ( mask & TG_FL ) {
+    voice->table[n] = tg_cycle_fl;
+    voice->weight[n++] = vol * p->vol_fl;
+  }
+
+  // reed and sharp voice use bl waves
+  // at octave border B->C a new sample buffer will be used
+  // this leads to ugly different sound - solution:
+  // average at octave border between samples for both octaves, linear transition
+  // weight:
+  // Ab:7*act+1*next, A:6a+2n, Bb:5a+3n, B:4a+4n,
+  // C:4*prev+4*act, C#:5a+3p, D:6a+2p, D#:7a+1p
+  // E, F, F#, G : only active octave
+  for ( int v = TG_RD; v <= TG_SH; v <<= 1 ) {
+    if ( !( mask & v ) )
+      continue;
+    const sample_t **cycle = TG_SH == v ? tg_cycle_sh : tg_cycle_rd;
+    float vol_v = vol * ( TG_SH == v ? p->vol_sh : p->vol_rd );
+    if ( octave > 0  && tone < 4 ) {
+      voice->table[n] = __atomic_load_n( cycle + octave-1, __ATOMIC_ACQUIRE );
+      voice->weight[n++] = (4-tone) * vol_v / 8;
+      voice->table[n] = __atomic_load_n( cycle + octave, __ATOMIC_ACQUIRE );
+      voice->weight[n++] = (4+tone) * vol_v / 8;
+      xfade = 1;
+    } else if ( octave < OCT_SAMP-1  && tone > 7 ) {
+      voice->table[n] = __atomic_load_n( cycle + octave, __ATOMIC_ACQUIRE );
+      voice->weight[n++] = (11+4-tone) * vol_v / 8;
+      voice->table[n] = __atomic_load_n( cycle + octave+1, __ATOMIC_ACQUIRE );
+      voice->weight[n++] = (tone-(11-4)) * vol_v / 8;
+      xfade = 1;
+    } else {
+      voice->table[n] = __atomic_load_n( cycle + octave, __ATOMIC_ACQUIRE );
+      voice->weight[n++] = vol_v;
+    }
+  } // for ( v )
+  return xfade;
+}
+
+
+
+// the oscillator kernel
+// accumulate one voice into acc[0..nframes-1]
+// offset and inc are the tone's sample offset and increment (octave 0)
+// the table positions of all frames are computed at once,
+// wrapped with the index mask and interpolated with the slope
+// always inlined with a constant number of tables, see tg_kernels[]
+//
+static inline __attribute__ (( always_inline ))
+void tg_osc( sample_t *acc, unsigned int nframes, const tg_voice_t *voice,
+             float offset, float inc, const int tables ) {
+  // start and step in the table of this octave, start wrapped
+  const unsigned int size = tg_cycle;
+  float start = offset * voice->mult;
+  start -= size * (unsigned int)( start / size );
+  const float step = inc * voice->mult;
+  unsigned int frame = 0;
+
+#if defined( TG_BASELINE )
+  // scalar only
+#elif defined( __AVX2__ )
+  const __m128i v_mask = _mm_set1_epi32( size - 1 );
+  const __m256 v_step8 = _mm256_set1_ps( 8 * step );
+  __m256 v_pos = _mm256_add_ps( _mm256_set1_ps( start ),
+                 _mm256_mul_ps( _mm256_set1_ps( step ),
+                                _mm256_setr_ps( 0, 1, 2, 3, 4, 5, 6, 7 ) ) );
+  for ( ; frame + 8 <= nframes; frame += 8 ) {
+    // pos >= 0, so truncation is floor
+    __m256i v_int = _mm256_cvttps_epi32( v_pos );
+    __m256 v_frac = _mm256_sub_ps( v_pos, _mm256_cvtepi32_ps( v_int ) );
+    __m128i v_idx_lo = _mm_and_si128( _mm256_castsi256_si128( v_int ), v_mask );
+    __m128i v_idx_hi = _mm_and_si128( _mm256_extracti128_si256( v_int, 1 ), v_mask );
+    __m256 v_acc = _mm256_loadu_ps( acc + frame );
+    for ( int t = 0; t < tables; t++ ) {
+      // gather the sample/slope pairs as doubles and split them
+      const double *pairs = (const double *)voice->table[t];
+      __m256 v_lo = _mm256_castpd_ps( _mm256_i32gather_pd( pairs, v_idx_lo, 8 ) );
+      __m256 v_hi = _mm256_castpd_ps( _mm256_i32gather_pd( pairs, v_idx_hi, 8 ) );
+      __m256 v_smp = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd(
+                     _mm256_shuffle_ps( v_lo, v_hi, _MM_SHUFFLE( 2, 0, 2, 0 ) ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+      __m256 v_slope = _mm256_castpd_ps( _mm256_permute4x64_pd( _mm256_castps_pd(
+                       _mm256_shuffle_ps( v_lo, v_hi, _MM_SHUFFLE( 3, 1, 3, 1 ) ) ), _MM_SHUFFLE( 3, 1, 2, 0 ) ) );
+      v_smp = _mm256_add_ps( v_smp, _mm256_mul_ps( v_frac, v_slope ) );
+      v_acc = _mm256_add_ps( v_acc, _mm256_mul_ps( v_smp, _mm256_set1_ps( voice->weight[t] ) ) );
+    }
+    _mm256_storeu_ps( acc + frame, v_acc );
+    v_pos = _mm256_add_ps( v_pos, v_step8 );
+  }
+#elif defined( __SSE2__ )
+  const __m128i v_mask = _mm_set1_epi32( size - 1 );
+  const __m128 v_step4 = _mm_set1_ps( 4 * step );
+  __m128 v_pos = _mm_add_ps( _mm_set1_ps( start ),
+                 _mm_mul_ps( _mm_set1_ps( step ), _mm_setr_ps( 0, 1, 2, 3 ) ) );
+  for ( ; frame + 4 <= nframes; frame += 4 ) {
+    // pos >= 0, so truncation is floor
+    __m128i v_int = _mm_cvttps_epi32( v_pos );
+    __m128 v_frac = _mm_sub_ps( v_pos, _mm_cvtepi32_ps( v_int ) );
+    int idx[4] __attribute__ (( aligned( 16 ) ));
+    _mm_store_si128( (__m128i *)idx, _mm_and_si128( v_int, v_mask ) );
+    __m128 v_acc = _mm_loadu_ps( acc + frame );
+    for ( int t = 0; t < tables; t++ ) {
+      // no gather, load two sample/slope pairs into each half and split them
+      const sample_t *table = voice->table[t];
+      __m128 v_01 = _mm_loadh_pi( _mm_loadl_pi( _mm_setzero_ps(), (const __m64 *)( table + 2 * idx[0] ) ),
+                                  (const __m64 *)( table + 2 * idx[1] ) );
+      __m128 v_23 = _mm_loadh_pi( _mm_loadl_pi( _mm_setzero_ps(), (const __m64 *)( table + 2 * idx[2] ) ),
+                                  (const __m64 *)( table + 2 * idx[3] ) );
+      __m128 v_smp = _mm_shuffle_ps( v_01, v_23, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+      __m128 v_slope = _mm_shuffle_ps( v_01, v_23, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+      v_smp = _mm_add_ps( v_smp, _mm_mul_ps( v_frac, v_slope ) );
+      v_acc = _mm_add_ps( v_acc, _mm_mul_ps( v_smp, _mm_set1_ps( voice->weight[t] ) ) );
+    }
+    _mm_storeu_ps( acc + frame, v_acc );
+    v_pos = _mm_add_ps( v_pos, v_step4 );
+  }
+#endif
+  // remaining frames (or all without SIMD)
+  for ( ; frame < nframes; frame++ ) {
+    float pos = start + frame * step;
+    int pos_int = pos;
+    float frac = pos - pos_int;
+#ifdef TG_BASELINE
+    // connie 1.x: a table of sample_rate / 8 + 1 points, truncated
+    // to its sample, taken here from the same point of the large table
+    const unsigned int old_size = tg_sample_rate / 8 + 1;
+    const unsigned int old = ( ( pos_int & ( size - 1 ) ) + frac ) * old_size / size;
+    const unsigned int idx = 2 * ( (unsigned int)( (double)old * size / old_size + 0.5 ) & ( size - 1 ) );
+    sample_t sample = 0.0;
+    for ( int t = 0; t < tables; t++ )
+      sample += voice->table[t][idx] * voice->weight[t];
+#else
+    const unsigned int idx = 2 * ( pos_int & ( size - 1 ) );
+    sample_t sample = 0.0;
+    for ( int t = 0; t < tables; t++ )
+      sample += ( voice->table[t][idx] + frac * voice->table[t][idx+1] ) * voice->weight[t];
+#endif
+    acc[frame] += sample;
+  }
+}
+
+
+
+
+// the render kernels, one for each number of tables
+// specialized at compile time, no voice branches in the frame loop
+typedef void (*tg_kernel_t)( sample_t *acc, unsigned int nframes, const tg_voice_t *voice,
+                             float offset, float inc );
+
+#define TG_KERNEL( tables ) \
+static void tg_osc_##tables( sample_t *acc, unsigned int nframes, const tg_voice_t *voice, \
+                             float offset, float inc ) { \
+  tg_osc( acc, nframes, voice, offset, inc, tables ); \
+}
+TG_KERNEL( 1 )
+TG_KERNEL( 2 )
+TG_KERNEL( 3 )
+TG_KERNEL( 4 )
+TG_KERNEL( 5 )
+#undef TG_KERNEL
+
+// nothing to do (all voices off)
+static void tg_osc_0( sample_t *acc, unsigned int nframes, const tg_voice_t *voice,
+                      float offset, float inc ) {
+}
+
+// kernel for each voice mask, [0]: inside octave, [1]: crossfade at octave border
+static const tg_kernel_t tg_kernels[9][2] = {
+  { tg_osc_0, tg_osc_0 }, // -
+  { tg_osc_1, tg_osc_1 }, // fl
+  { tg_osc_1, tg_osc_2 }, // rd
+  { tg_osc_2, tg_osc_3 }, // fl rd
+  { tg_osc_1, tg_osc_2 }, // sh
+  { tg_osc_2, tg_osc_3 }, // fl sh
+  { tg_osc_2, tg_osc_4 }, // rd sh
+  { tg_osc_3, tg_osc_5 }, // fl rd sh
+  { tg_osc_1, tg_osc_2 }, // premixed
+};
+
+
+
+// voice masks of the organ models
+// CONNIE: flute, reed and sharp according to the drawbars
+static int tg_mask_connie( const tg_div_param_t *p ) {
+  return ( p->vol_fl ? TG_FL : 0 ) | ( p->vol_rd ? TG_RD : 0 ) | ( p->vol_sh ? TG_SH : 0 );
+}
+// HAMMOND: sine waves only
+static int tg_mask_hammond( const tg_div_param_t *p ) {
+  return p->vol_fl ? TG_FL : 0;
+}
+
+// indexed by model_t, a new model plugs in its mask function here
+static int ( * const tg_model_mask[] )( const tg_div_param_t *p ) = {
+  tg_mask_connie,
+  tg_mask_hammond
+};
+
+
+
+// the voices of each division for the drawbars and model (block start)
+// more than one voice: the premixed tables if they match tables and volumes
+static void tg_select_kernel( void ) {
+  for ( int div = 0; div < tg_divisions; div++ ) {
+    const tg_div_param_t *p = tg_p->div + div;
+    const tg_premix_t *premix = tg_div[div].premix;
+    int mask = tg_model_mask[ connie_model ]( p );
+    if ( ( mask & ( mask - 1 ) ) && premix && premix->key.serial == tg_tables->serial
+         && premix->key.vol_fl == p->vol_fl && premix->key.vol_rd == p->vol_rd
+         && premix->key.vol_sh == p->vol_sh )
+      mask = TG_MIX;
+    tg_div[div].voice_mask = mask;
+  }
+}
+
+
+
+// mix the notes first..last-1 of the play list into acc[division]
+// reads only data that is constant during the oscillator part of a block
+static void tg_osc_notes( sample_t (*acc)[TG_BLOCK], unsigned int nframes, int first, int last ) {
+  for ( int iii = first; iii < last; iii++ ) {
+    int d = tg_play_list[iii] >> 8;
+    int note = tg_play_list[iii] & 0xff;
+    const tg_div_t *div = tg_div + d;
+    int vol = div->vol_note[note];
+    if ( vol ) { // note actually playing
+      int tone = ( note - LOWNOTE ) % 12;
+      int octave = ( note - LOWNOTE ) / 12;
+      tg_voice_t voice;
+      int xfade = tg_voice( &voice, tone, octave, vol, div, tg_p->div + d );
+      tg_kernels[div->voice_mask][xfade]( acc[d], nframes, &voice,
+                                          tg_sample_offset[tone], tg_sample_inc[tone] );
+    } // if ( vol )
+  } // for ( iii )
+}
+
+
+
+// vol_raw of an active key has changed, ramp it at the next key scan
+static void tg_key_ramp( tg_div_t *div, int key )
+{
+  if ( div->key_on[key] && !div->ramp_on[key] ) {
+    div->ramp_on[key] = 1;
+    div->ramp_list[div->ramps++] = key;
+  }
+}
+
+
+
+// put a key into the active list
+static void tg_key_activate( tg_div_t *div, int key )
+{
+  if ( key >= LOWNOTE && key < HIGHNOTE && !div->key_on[key] ) {
+    div->key_on[key] = 1;
+    div->key_list[div->keys++] = key;
+  }
+  tg_key_ramp( div, key );
+}
+
+
+
+static int transpose_note( int note )
+{
+  note += tg_p->transpose;
+  if ( note < LOWNOTE || note > HIGHNOTE )
+    return 0;
+  else
+    return note;
+}
+
+
+
+// ******************************************
+// midi input
+//
+// decode one midi event, called between two blocks
+// ******************************************
+//
+// one midi event for this division
+static void tg_midi_div( tg_div_t *div, int d, const unsigned char *buffer, size_t size ) {
+  if ( size == 3 ) { // noteon, noteoff, cc
+    int note;
+    if ( ( buffer[0] >> 4 ) == 0x08 ) { // note_off note vol
+      note = div->note_of_key[ buffer[1] & 0x7F ];
+      div->vol_raw[note]=0;
+      tg_key_ramp( div, note );
+    } else if ( ( buffer[0] >> 4 ) == 0x09 ) {// note_on note vol
+      if ( buffer[2] ) {
+        // keys outside the range are played by another division
+        if ( buffer[1] < tg_div_low[d] || buffer[1] > tg_div_high[d] )
+          return;
+        note = div->note_of_key[ buffer[1] & 0x7F ] = transpose_note( buffer[1] );
+        div->vol_raw[note] = VOL_RAW_MAX;
+        tg_key_activate( div, note );
+      } else {
+        note = div->note_of_key[ buffer[1] & 0x7F ];
+        div->vol_raw[note] = 0;
+        tg_key_ramp( div, note );
+      }
+    } else if ( ( buffer[0] >> 4 ) == 0x0B ) {// cc num val
+      int cc = buffer[1];
+      midi_cc[cc] = buffer[2];
+      if ( cc == 7 ) {
+        div->master_vol = buffer[2] * buffer[2] / 127.0 / 127.0;
+      } else if ( 120 == cc || 123 == cc ) { // all sounds/notes off
+        tg_do_panic( div );
+      } else if ( TG_CC_INTONATION == cc ) { // tuning is done by the ui
+        fifo_put( &tg_cmd_out, TG_CMD_INTONATION, buffer[2] );
+      } else if ( TG_CC_PITCH == cc ) {
+        fifo_put( &tg_cmd_out, TG_CMD_PITCH, buffer[2] );
+      } else if ( TG_CC_TRANSPOSE == cc ) {
+        fifo_put( &tg_cmd_out, TG_CMD_TRANSPOSE, buffer[2] );
+      }
+    } else if ( ( buffer[0] >> 4 ) == 0x0E ) {// pitch wheel
+      midi_pitch = 128 * buffer[2] + buffer[1] - 0x2000;
+    }
+  } else if ( size == 2 ) { // prog change
+    if ( ( buffer[0] >> 4 ) == 0x0C ) { // prog change
+      midi_prog = buffer[1];
+      // the ui sets the drawbars of this division and publishes them
+      // (no wake up from here, the ui looks for it, see tg_notify())
+      fifo_put( &tg_cmd_out, TG_CMD_PROGRAM, d << 8 | midi_prog );
+    }
+  } // if ( size ... )
+} // tg_midi_div()
+
+
+
+void tg_midi_in( const unsigned char *buffer, size_t size ) {
+  // each division whose channel (0: all, or 1..16) matches
+  for ( int d = 0; d < tg_divisions; d++ ) {
+    if ( !tg_div_channel[d] || tg_div_channel[d]-1 == ( *buffer & 0xF ) )
+      tg_midi_div( tg_div + d, d, buffer, size );
+  }
+} // tg_midi_in()
+
+
+
+// add the notes of a key at the stops to the note volumes,
+// from is its old and to its new key volume
+static void tg_key_stops( tg_div_t *div, int key, int from, int to ) {
+  for ( int stop = 0; stop < 9; stop++ ) {
+    const float vol = div->vol_stop[stop];
+    if ( !vol )
+      continue;
+    int note = key + tg_stop_offset[stop];
+    div->vol_note[note] += (int)( to * vol ) - (int)( from * vol );
+    // notes below LOWNOTE (16' of lowest octave) are never played
+    if ( to && note >= LOWNOTE && !div->note_on[note] ) {
+      div->note_on[note] = 1;
+      div->note_list[div->notes++] = note;
+    }
+  } // for ( stop )
+}
+
+
+
+// key scan of one division, ticks * 100 us
+// only the ramping keys change their notes, a held chord costs nothing
+// returns 1 if the note list has changed
+static int tg_scan( tg_div_t *div, const tg_div_param_t *p, int ticks ) {
+  // the drawbars have moved
+  if ( memcmp( div->vol_stop, p->vol, sizeof( div->vol_stop ) ) ) {
+    memcpy( div->vol_stop, p->vol, sizeof( div->vol_stop ) );
+    div->restack = 1;
+  }
+  if ( !div->ramps && !div->restack )
+    return 0;
+
+  const float percussion = p->percussion;
+  int act_keys = 0;
+  if ( percussion ) {
+    // count active keys
+    for ( int iii = 0; iii < div->keys; iii++ )
+      if ( div->vol_raw[ div->key_list[iii] ] )
+        act_keys++;
+  }
+
+  // ramp the midi volumes up/down to remove the clicking at key press/release
+  // only the keys in the ramp list can change
+  const int notes = div->notes;
+  int faded = 0;
+  for ( int iii = 0; iii < div->ramps; ) {
+    int key = div->ramp_list[iii];
+    int step = 1 << ( ( key - LOWNOTE ) / 12 ); // doubles every octave
+    int *p_smooth = div->vol_smooth + key;
+    int raw = div->vol_raw[key];
+    for ( int tick = 0; tick < ticks; tick++ ) {
+      if ( *p_smooth < raw ) {
+        if ( percussion && 1 == act_keys && 0 == *p_smooth ) {
+          (*p_smooth) = 2 * VOL_RAW_MAX * percussion; // hard step
+        } else {
+          (*p_smooth) += 5 * step; // attack quickly up (100 ms)
+        }
+      } else if ( *p_smooth > raw ) {
+        (*p_smooth) -= step ; // decay/release slowly down (500 ms in lowes octave)
+        if ( *p_smooth < raw ) // do not undershoot (-> soft_step[-1])
+          *p_smooth = raw;
+      }
+    } // for ( tick )
+
+    // the new key volume moves the notes of its stops
+    int vol_key = soft_step[ *p_smooth ];
+    if ( !div->restack && vol_key != div->vol_key[key] )
+      tg_key_stops( div, key, div->vol_key[key], vol_key );
+    div->vol_key[key] = vol_key;
+    if ( *p_smooth != raw ) {
+      iii++;
+      continue;
+    }
+    // done, drop the key if it has faded out
+    div->ramp_on[key] = 0;
+    div->ramp_list[iii] = div->ramp_list[--div->ramps];
+    if ( 0 == *p_smooth ) {
+      for ( int kkk = 0; kkk < div->keys; kkk++ ) {
+        if ( div->key_list[kkk] == key ) {
+          div->key_on[key] = 0;
+          div->key_list[kkk] = div->key_list[--div->keys];
+          break;
+        }
+      }
+      faded = 1;
+    }
+  } // for ( iii )
+
+  if ( div->restack ) {
+    // clear the partial volumes of the last scan
+    for ( int iii = 0; iii < div->notes; iii++ ) {
+      int note = div->note_list[iii];
+      div->note_on[note] = 0;
+    }
+    for ( int iii = 0; iii < NOTE_MAX; iii++ )
+      div->vol_note[iii] = 0;
+    div->notes = 0;
+    // scan key volumes and mix the note volumes according to the stops
+    for ( int iii = 0; iii < div->keys; iii++ ) {
+      int key = div->key_list[iii];
+      if ( div->vol_key[key] ) // key pressed?
+        tg_key_stops( div, key, 0, div->vol_key[key] );
+    }
+    div->restack = 0;
+    return 1;
+  }
+
+  // drop the notes of the faded keys
+  if ( faded ) {
+    for ( int iii = 0; iii < div->notes; ) {
+      int note = div->note_list[iii];
+      if ( !div->vol_note[note] ) {
+        div->note_on[note] = 0;
+        div->note_list[iii] = div->note_list[--div->notes];
+      } else {
+        iii++;
+      }
+    }
+    return 1;
+  }
+  return notes != div->notes;
+} // tg_scan()
+
+
+
+// ******************************************
+// control rate processing
+//
+// vibrato lfo, key scan and stop mixture,
+// done once at the start of each block
+// ******************************************
+//
+static void tg_control( unsigned int nframes ) {
+
+  // freq modulation for vibrato
+  // attac/decay/release
+  static int timer = 0;
+
+  // shifting the pitch and volume for (simple) leslie sim
+  // shift is a sin signal used for fm and am
+  // tg_vibrato 0..1 -> freq 0..1*VIBRATO Hz
+  const float vibrato = tg_p->vibrato;
+  if ( vibrato ) {
+    tg_shift_offset += nframes * vibrato * VIBRATO * tg_cy_per_frame; // shift frequency
+    while ( tg_shift_offset >= tg_cycle )
+      tg_shift_offset -= tg_cycle;
+    tg_shift = tg_cycle_fl[ 2 * (int)tg_shift_offset ];
+  } else {
+    tg_shift_offset = tg_shift = 0.0;
+  }
+
+  // advance individual sample pointer, do fm for vibrato
+  // vibrato 0..8 -> 0..8 Hz rot. speed
+  // typical leslie horn length 0.5 m
+  // at rotation speed 1/s the transl. speed of horn mouth ist v=1m/s
+  // the doppler formula: f' = f * 1 / ( 1 - v/c )
+  // at 1 Hz -> f' = 1 +- 0.003 ( 5 cent shift per Hz )
+  // midi pitch bend about +- 2 halftones
+  // the frequencies of the actual scale and pitch
+  const float *freq = tg_scale_freq[ tg_p->intonation ];
+  const float tune = tg_p->concert_pitch / 440.f * tg_cy_per_frame;
+  for ( int tone = 0; tone < 12; tone++ ) {
+    tg_sample_inc[tone] = ( 1.0 + midi_pitch/70000.0 + 0.003 * tg_shift * vibrato * VIBRATO )
+                        * freq[LOWNOTE+tone] * tune;
+  }
+
+  // process the keys (attac/decay/release) every 100us (10 kHz)
+  // count the key scan ticks that fall into this block
+  int ticks = 0;
+  timer += nframes;
+  while ( timer > tg_scan_frames ) {
+    timer -= tg_scan_frames + 1;
+    ticks++;
+  }
+  if ( !ticks )
+    return;
+
+  int changed = 0;
+  for ( int d = 0; d < tg_divisions; d++ )
+    changed |= tg_scan( tg_div + d, tg_p->div + d, ticks );
+  if ( !changed )
+    return;
+
+  // the notes of all divisions for the oscillators
+  tg_plays = 0;
+  for ( int d = 0; d < tg_divisions; d++ )
+    for ( int iii = 0; iii < tg_div[d].notes; iii++ )
+      tg_play_list[tg_plays++] = d << 8 | tg_div[d].note_list[iii];
+} // tg_control()
+
+
+
+// wait until all tables of a set are built
+static void tg_tables_wait( tg_tables_t *tables )
+{
+  for ( int iii = 0; iii < tables->workers; iii++ )
+    pthread_join( tables->worker[ iii ], NULL );
+  tables->workers = 0;
+} // tg_tables_wait()
+
+
+
+// free a set, must not be used by the rt thread
+static void tg_tables_free( tg_tables_t *tables )
+{
+  if ( !tables )
+    return;
+  // no more octaves for an unfinished set
+  __atomic_store_n( &tables->next, OCT_SAMP, __ATOMIC_RELAXED );
+  tg_tables_wait( tables );
+  free( tables->fl );
+  free( tables->mem );
+  cache_unmap( &tables->key, tables->map );
+  free( tables );
+} // tg_tables_free()
+
+
+
+// make a set the active one (rt thread)
+// the phases go on, scaled if the set has another size
+static void tg_tables_use( tg_tables_t *tables )
+{
+  if ( tables->size != tg_cycle ) {
+    const float scale = (float)tables->size / tg_cycle;
+    for ( int tone = 0; tone < 12; tone++ )
+      tg_sample_offset[tone] *= scale;
+    tg_shift_offset *= scale;
+    tg_cycle = tables->size;
+  }
+  tg_tables = tables;
+  tg_cycle_fl = tables->fl;
+  tg_cycle_rd = tables->rd;
+  tg_cycle_sh = tables->sh;
+  tg_cy_per_frame = (float)tables->size / tables->sample_rate;
+  tg_scan_frames = tables->sample_rate / 10000;
+} // tg_tables_use()
+
+
+
+// take a new set if there is one (rt thread, block start)
+// no allocation, no locks: the old set is freed outside
+static void tg_tables_fetch( void )
+{
+  if ( !__atomic_load_n( &tg_tables_next, __ATOMIC_RELAXED )
+       || __atomic_load_n( &tg_tables_old, __ATOMIC_ACQUIRE ) )
+    return;
+  tg_tables_t *old = tg_tables;
+  tg_tables_use( __atomic_exchange_n( &tg_tables_next, NULL, __ATOMIC_ACQ_REL ) );
+  __atomic_store_n( &tg_tables_old, old, __ATOMIC_RELEASE );
+} // tg_tables_fetch()
+
+
+
+// take the premixed tables built for each division (rt thread, block start)
+// and give the replaced ones back
+static void tg_premix_fetch( void )
+{
+  // unused divisions never get one
+  for ( int d = 0; d < TG_DIVISIONS; d++ ) {
+    if ( !__atomic_load_n( tg_premix_next + d, __ATOMIC_RELAXED ) )
+      continue;
+    tg_premix_t *old = tg_div[d].premix;
+    // NULL if the ui took it back meanwhile
+    tg_div[d].premix = __atomic_exchange_n( tg_premix_next + d, NULL, __ATOMIC_ACQ_REL );
+    if ( old )
+      __atomic_store_n( tg_premix_free + d, old, __ATOMIC_RELEASE );
+  }
+} // tg_premix_fetch()
+
+
+
+// hand the latest set to the rt thread once all octaves are built,
+// until then the rt thread keeps playing the set it has (not rt, locked)
+// nothing here waits for the rt thread
+static void tg_tables_handover( void )
+{
+  // the set that was replaced last time, freed now or with the next one
+  tg_tables_free( __atomic_exchange_n( &tg_tables_old, NULL, __ATOMIC_ACQ_REL ) );
+  if ( !tg_tables_building || __atomic_load_n( &tg_tables_latest->left, __ATOMIC_ACQUIRE ) )
+    return;
+  tg_tables_building = 0;
+  // a set not yet taken is not used by the rt thread
+  tg_tables_free( __atomic_exchange_n( &tg_tables_next, tg_tables_latest, __ATOMIC_ACQ_REL ) );
+} // tg_tables_handover()
+
+
+
+// premix the voices of each division whose drawbars or tables
+// have changed since the last time (not rt)
+// only with complete tables, else when the table workers wake the ui
+static void tg_premix_update( void )
+{
+  pthread_mutex_lock( &tg_tables_lock );
+  tg_tables_handover();
+  const tg_tables_t *tables = tg_tables_latest;
+  if ( tables && !tg_tables_building && !__atomic_load_n( &tables->left, __ATOMIC_ACQUIRE ) ) {
+    for ( int d = 0; d < tg_divisions; d++ ) {
+      const tg_div_param_t *p = tg_div_ui + d;
+      const tg_premix_key_t key = { tables->serial, p->vol_fl, p->vol_rd, p->vol_sh };
+      int mask = tg_model_mask[ connie_model ]( p );
+      if ( !( mask & ( mask - 1 ) ) || !memcmp( &key, tg_premix_done + d, sizeof( key ) ) )
+        continue; // one voice needs no premix, or up to date
+      // the one not yet taken, or the one the rt thread gave back
+      tg_premix_t *premix = __atomic_exchange_n( tg_premix_next + d, NULL, __ATOMIC_ACQ_REL );
+      while ( !premix ) {
+        premix = __atomic_exchange_n( tg_premix_free + d, NULL, __ATOMIC_ACQ_REL );
+        // none of both: the rt thread is between the two steps of
+        // tg_premix_fetch() and gives the old one back at once
+        if ( !premix )
+          sched_yield();
+      }
+      premix->key = key;
+      for ( int oct = 0; oct < OCT_SAMP; oct++ ) {
+        const sample_t *rd = tables->rd[ oct ];
+        const sample_t *sh = tables->sh[ oct ];
+        for ( unsigned int i = 0; i < 2 * tables->size; i++ )
+          premix->cycle[oct][i] = key.vol_fl * tables->fl[i] + key.vol_rd * rd[i] + key.vol_sh * sh[i];
+      }
+      __atomic_store_n( tg_premix_next + d, premix, __ATOMIC_RELEASE );
+      tg_premix_done[d] = key;
+    }
+  }
+  pthread_mutex_unlock( &tg_tables_lock );
+} // tg_premix_update()
+
+
+
+// ui thread is idle
+void tg_idle( void )
+{
+  tg_premix_update();
+} // tg_idle()
+
+
+
+// ******************************************
+// note mixing on several cores (optional)
+//
+// the rt thread and the pool workers take the
+// active notes in chunks from a shared counter
+// and mix them into their own block buffer.
+// the counter holds the block number in the
+// upper bits, a worker that comes late sees a
+// new block number and takes nothing. the rt
+// thread takes the remaining notes itself, so
+// it waits at most for the chunks in progress.
+// ******************************************
+//
+#define TG_POOL_MAX 8          // threads incl. the rt thread
+#define TG_POOL_CHUNK 2        // notes taken at once
+#define TG_POOL_NOTES 8        // with less notes the rt thread mixes alone
+#define TG_POOL_SPIN 4         // a worker spins 1/TG_POOL_SPIN block, then sleeps
+
+// the mix of one worker, one cache line apart
+typedef struct {
+  sample_t mix[TG_DIVISIONS][TG_BLOCK];
+  unsigned int block; // mix belongs to this block
+} __attribute__ (( aligned( 64 ) )) tg_part_t;
+
+// mixing threads incl. the rt thread, 1: off
+static int tg_pool_threads = 1;
+static pthread_t tg_pool_worker[TG_POOL_MAX];
+static tg_part_t tg_pool_part[TG_POOL_MAX];
+// block << TG_POOL_BITS | next note, also the futex of the sleeping workers
+#define TG_POOL_BITS 10
+#define TG_POOL_NOTE ( ( 1 << TG_POOL_BITS ) - 1 )
+#define TG_POOL_BLOCK ( UINT_MAX >> TG_POOL_BITS )
+static unsigned int tg_pool_next = 0;
+// notes mixed in this block
+static int tg_pool_done = 0;
+// notes and frames of the running block
+static int tg_pool_notes = 0;
+static unsigned int tg_pool_frames = 0;
+static int tg_pool_sleepers = 0;
+static int tg_pool_quit = 0;
+// the last block number (rt thread)
+static unsigned int tg_pool_block = 0;
+
+
+
+static inline void tg_pause( void ) {
+#if defined( __i386__ ) || defined( __x86_64__ )
+  __builtin_ia32_pause();
+#elif defined( __aarch64__ )
+  __asm__ __volatile__ ( "yield" );
+#endif
+}
+
+
+
+static long long tg_pool_ns( void ) {
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+
+// ns a worker spins for the next block: the blocks of one period follow
+// each other at once, between the periods the workers sleep
+static long long tg_pool_idle( void ) {
+  unsigned int rate = __atomic_load_n( &tg_sample_rate, __ATOMIC_RELAXED );
+  if ( !rate )
+    rate = 48000;
+  return TG_BLOCK * 1000000000LL / TG_POOL_SPIN / rate;
+}
+
+
+
+// take the next chunk of notes of this block, -1: nothing left
+static int tg_pool_take( unsigned int block ) {
+  unsigned int next = __atomic_load_n( &tg_pool_next, __ATOMIC_ACQUIRE );
+  do {
+    if ( next >> TG_POOL_BITS != block
+      || ( next & TG_POOL_NOTE ) >= __atomic_load_n( &tg_pool_notes, __ATOMIC_RELAXED ) )
+      return -1;
+  } while ( !__atomic_compare_exchange_n( &tg_pool_next, &next, next + TG_POOL_CHUNK,
+                                          1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE ) );
+  return next & TG_POOL_NOTE;
+}
+
+
+
+// mix chunks of this block into acc until all notes are taken
+static void tg_pool_mix( sample_t (*acc)[TG_BLOCK], unsigned int block ) {
+  int first;
+  while ( ( first = tg_pool_take( block ) ) >= 0 ) {
+    // valid now, the block waits for this chunk
+    const int notes = __atomic_load_n( &tg_pool_notes, __ATOMIC_RELAXED );
+    const unsigned int frames = __atomic_load_n( &tg_pool_frames, __ATOMIC_RELAXED );
+    const int last = first + TG_POOL_CHUNK < notes ? first + TG_POOL_CHUNK : notes;
+    tg_osc_notes( acc, frames, first, last );
+    __atomic_add_fetch( &tg_pool_done, last - first, __ATOMIC_RELEASE );
+  }
+}
+
+
+
+// a pool worker, spins while blocks come in, sleeps when idle
+static void *tg_pool_work( void *arg ) {
+  tg_part_t *part = arg;
+  tg_ftz();
+  unsigned int seen = 0;
+  for ( ;; ) {
+    unsigned int next;
+    const long long spin_ns = tg_pool_idle();
+    long long idle = tg_pool_ns();
+    int spin = 0;
+    while ( ( next = __atomic_load_n( &tg_pool_next, __ATOMIC_ACQUIRE ) ) >> TG_POOL_BITS == seen ) {
+      tg_pause();
+      if ( ++spin & 0xff )
+        continue;
+      if ( tg_pool_ns() - idle < spin_ns )
+        continue;
+      // the rt thread wakes us if it sees a sleeper after its store
+      __atomic_add_fetch( &tg_pool_sleepers, 1, __ATOMIC_SEQ_CST );
+      syscall( SYS_futex, &tg_pool_next, FUTEX_WAIT_PRIVATE, next, NULL, NULL, 0 );
+      __atomic_sub_fetch( &tg_pool_sleepers, 1, __ATOMIC_SEQ_CST );
+      idle = tg_pool_ns();
+    }
+    if ( __atomic_load_n( &tg_pool_quit, __ATOMIC_ACQUIRE ) )
+      return NULL;
+    seen = next >> TG_POOL_BITS;
+    memset( part->mix, 0, tg_divisions * sizeof( part->mix[0] ) );
+    __atomic_store_n( &part->block, seen, __ATOMIC_RELEASE );
+    tg_pool_mix( part->mix, seen );
+  }
+}
+
+
+
+// mix all notes of this block with the pool (rt thread)
+static void tg_pool_run( sample_t (*acc)[TG_BLOCK], unsigned int nframes ) {
+  const unsigned int block = tg_pool_block = ( tg_pool_block + 1 ) & TG_POOL_BLOCK;
+  __atomic_store_n( &tg_pool_notes, tg_plays, __ATOMIC_RELAXED );
+  __atomic_store_n( &tg_pool_frames, nframes, __ATOMIC_RELAXED );
+  __atomic_store_n( &tg_pool_done, 0, __ATOMIC_RELAXED );
+  __atomic_store_n( &tg_pool_next, block << TG_POOL_BITS, __ATOMIC_SEQ_CST );
+  if ( __atomic_load_n( &tg_pool_sleepers, __ATOMIC_SEQ_CST ) )
+    syscall( SYS_futex, &tg_pool_next, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0 );
+  tg_pool_mix( acc, block );
+  // all taken, wait for the chunks in progress
+  while ( __atomic_load_n( &tg_pool_done, __ATOMIC_ACQUIRE ) < tg_plays )
+    tg_pause();
+  for ( int w = 1; w < tg_pool_threads; w++ ) {
+    const tg_part_t *part = tg_pool_part + w;
+    if ( __atomic_load_n( &part->block, __ATOMIC_ACQUIRE ) != block )
+      continue; // came too late, took nothing
+    for ( int d = 0; d < tg_divisions; d++ )
+      for ( unsigned int frame = 0; frame < nframes; frame++ )
+        acc[d][frame] += part->mix[d][frame];
+  }
+}
+
+
+
+// start the pool workers (not while the rt thread runs)
+void tg_threads( int threads, int priority )
+{
+  long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+  if ( threads > cpus ) {
+    threads = cpus;
+    if ( threads <= 1 )
+      printf( "one cpu, notes are mixed in one thread\n" );
+  }
+  if ( threads > TG_POOL_MAX )
+    threads = TG_POOL_MAX;
+  if ( threads <= 1 || tg_pool_threads > 1 )
+    return;
+  int w;
+  for ( w = 1; w < threads; w++ ) {
+    pthread_attr_t attr;
+    pthread_attr_init( &attr );
+    if ( priority > 0 ) {
+      struct sched_param param = { .sched_priority = priority };
+      pthread_attr_setinheritsched( &attr, PTHREAD_EXPLICIT_SCHED );
+      pthread_attr_setschedpolicy( &attr, SCHED_FIFO );
+      pthread_attr_setschedparam( &attr, &param );
+    }
+    int err = pthread_create( tg_pool_worker + w, &attr, tg_pool_work, tg_pool_part + w );
+    pthread_attr_destroy( &attr );
+    if ( err && priority > 0 ) {
+      fprintf( stderr, "connie: no realtime priority for the note threads\n" );
+      priority = 0;
+      w--; // again without
+      continue;
+    }
+    if ( err ) {
+      fprintf( stderr, "connie: cannot start the note threads\n" );
+      break;
+    }
+  }
+  __atomic_store_n( &tg_pool_threads, w, __ATOMIC_RELEASE );
+  printf( "notes are mixed in %d threads\n", w );
+} // tg_threads()
+
+
+
+// stop the pool workers (not while the rt thread runs)
+static void tg_threads_stop( void )
+{
+  if ( tg_pool_threads <= 1 )
+    return;
+  __atomic_store_n( &tg_pool_quit, 1, __ATOMIC_RELEASE );
+  tg_pool_block = ( tg_pool_block + 1 ) & TG_POOL_BLOCK;
+  __atomic_store_n( &tg_pool_next, tg_pool_block << TG_POOL_BITS, __ATOMIC_SEQ_CST );
+  syscall( SYS_futex, &tg_pool_next, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0 );
+  for ( int w = 1; w < tg_pool_threads; w++ )
+    pthread_join( tg_pool_worker[w], NULL );
+  tg_pool_threads = 1;
+  tg_pool_quit = 0;
+} // tg_threads_stop()
+
+
+
+// ******************************************
+// render one period of audio
+//
+// split into blocks of max. TG_BLOCK frames,
+// control data is constant during one block
+// ******************************************
+//
+void tg_render( sample_t *const *out, unsigned int offset, unsigned int nframes ) {
+  // first call in this thread
+  static __thread int ftz = 0;
+  if ( !ftz ) {
+    tg_ftz();
+    ftz = 1;
+  }
+
+  while ( nframes ) {
+    unsigned int block = nframes < TG_BLOCK ? nframes : TG_BLOCK;
+
+    PROF_BEGIN( PROF_SCAN );
+    // parameters, commands and tables of the other threads land here
+    tg_tables_fetch();
+    tg_fetch();
+    tg_premix_fetch();
+    tg_do_cmd();
+    tg_control( block );
+    tg_select_kernel();
+    PROF_END( PROF_SCAN );
+
+    // 20% (?) am for "leslie"
+    const float am_l = 1.0f - tg_shift / 5;
+    const float am_r = 1.0f + tg_shift / 5;
+
+    // polyphonic output with drawbars tg_vol_xx
+    // mix all playing notes into the block buffer of their division
+    //
+    PROF_BEGIN( PROF_OSC );
+    for ( int d = 0; d < tg_divisions; d++ )
+      for ( unsigned int frame = 0; frame < block; frame++ )
+        tg_mix[d][frame] = 0.0;
+
+    // many notes: share them with the pool threads
+    if ( tg_plays >= TG_POOL_NOTES && __atomic_load_n( &tg_pool_threads, __ATOMIC_ACQUIRE ) > 1 )
+      tg_pool_run( tg_mix, block );
+    else
+      tg_osc_notes( tg_mix, block, 0, tg_plays );
+
+    // advance individual sample pointer
+    for ( int tone = 0; tone < 12; tone++ ) {
+      tg_sample_offset[tone] += block * tg_sample_inc[tone];
+      while ( tg_sample_offset[tone] >= tg_cycle ) { // zero crossing
+        tg_sample_offset[tone] -= tg_cycle;
+      }
+    } // for ( tone )
+    PROF_END( PROF_OSC );
+
+    // fill the buffers
+    // this implements the signal flow of an electronic organ
+    PROF_BEGIN( PROF_REVERB );
+    if ( tg_p->reverb_lines != tg_fdn_lines || tg_tables->sample_rate != tg_reverb_rate ) {
+      // switched or new sample rate, start with a clean reverb
+      tg_fdn_lines = tg_p->reverb_lines;
+      tg_reverb_rate = tg_tables->sample_rate;
+      for ( int d = 0; d < tg_divisions; d++ ) {
+        if ( tg_fdn_lines )
+          fdn_init( &tg_div[d].fdn, tg_fdn_lines, tg_reverb_rate );
+        else
+          reverb_init( &tg_div[d].rev, tg_reverb_rate );
+      }
+    }
+    for ( int d = 0; d < tg_divisions; d++ ) {
+      tg_div_t *div = tg_div + d;
+      sample_t *mix = tg_mix[d];
+      // normalize the output
+      // tg_vol_16, tg_vol_8, tg_vol_4, tg_vol_IV, tg_vol_fl, tg_vol_rd and tg_vol_sh: range 0..64
+      // allow summing of multiple keys, stops, voices
+      const float norm = div->master_vol / VOL_RAW_MAX / 16;
+      for ( unsigned int frame = 0; frame < block; frame++ )
+        mix[frame] *= norm;
+      // add some reverb
+      const float wet = tg_p->div[d].reverb;
+      if ( !tg_fdn_lines ) {
+        reverb_process( &div->rev, mix, div->wet, block );
+        for ( unsigned int frame = 0; frame < block; frame++ )
+          mix[frame] += wet * div->wet[frame];
+      } else {
+        fdn_process( &div->fdn, mix, div->wet, div->wet_r, block );
+      }
+    }
+    PROF_END( PROF_REVERB );
+
+    PROF_BEGIN( PROF_CLIP );
+    for ( int d = 0; d < tg_divisions; d++ ) {
+      const tg_div_t *div = tg_div + d;
+      const sample_t *mix = tg_mix[d];
+      sample_t *out_l = out[2*d] + offset;
+      sample_t *out_r = out[2*d+1] + offset;
+      if ( !tg_fdn_lines ) {
+        for ( unsigned int frame = 0; frame < block; frame++ ) {
+          // do soft (valve style) clipping
+          sample_t sample = 1.2 * clip( mix[frame] );
+          // sample is now in the range [-0.8..0.8]
+          out_l[frame] = sample * am_l;
+          out_r[frame] = sample * am_r;
+        } // for ( frame )
+      } else {
+        // stereo reverb, clip both sides
+        const float wet = tg_p->div[d].reverb;
+        for ( unsigned int frame = 0; frame < block; frame++ ) {
+          out_l[frame] = 1.2 * clip( mix[frame] + wet * div->wet[frame] ) * am_l;
+          out_r[frame] = 1.2 * clip( mix[frame] + wet * div->wet_r[frame] ) * am_r;
+        } // for ( frame )
+      }
+    } // for ( d )
+    PROF_END( PROF_CLIP );
+
+    offset += block;
+    nframes -= block;
+  } // while ( nframes )
+} // tg_render()
+
+
+
+// wait until all tables are built and handed over
+void tg_wait( void )
+{
+  if ( tg_tables_latest )
+    tg_tables_wait( tg_tables_latest );
+  tg_premix_update();
+} // tg_wait()
+
+
+
+// stop the note threads, free the tables
+void tg_shutdown( void )
+{
+  tg_threads_stop();
+  // free memory (not necessary)
+  tg_tables_free( tg_tables );
+  tg_tables_free( tg_tables_next );
+  tg_tables_free( tg_tables_old );
+  if ( tg_tables_building )
+    tg_tables_free( tg_tables_latest );
+  tg_tables = tg_tables_next = tg_tables_old = tg_tables_latest = NULL;
+  tg_tables_building = 0;
+  tg_tables_rate = 0;
+  free( tg_premix_mem );
+  tg_premix_mem = NULL;
+  free( tg_scale_freq );
+  tg_scale_freq = NULL;
+} // tg_shutdown()
+
+
+
+// name of an intonation scale for the help and ui
+const char *tg_scale_name( int scale )
+{
+  return scales[scale].label;
+}
+
+
+
+
+// in place complex fft, n = 2^k
+// sign -1: forward, +1: inverse (not normalized)
+static void tg_fft( double *re, double *im, unsigned int n, int sign ) {
+  // bit reversed order
+  for ( unsigned int i = 1, j = 0; i < n; i++ ) {
+    unsigned int bit = n >> 1;
+    for ( ; j & bit; bit >>= 1 )
+      j ^= bit;
+    j ^= bit;
+    if ( i < j ) {
+      double t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+  // butterflies
+  for ( unsigned int len = 2; len <= n; len <<= 1 ) {
+    double arg = sign * 2 * M_PI / len;
+    for ( unsigned int k = 0; k < len / 2; k++ ) {
+      double wr = cos( k * arg );
+      double wi = sin( k * arg );
+      for ( unsigned int i = k; i < n; i += len ) {
+        unsigned int j = i + len / 2;
+        double xr = re[j] * wr - im[j] * wi;
+        double xi = re[j] * wi + im[j] * wr;
+        re[j] = re[i] - xr;
+        im[j] = im[i] - xi;
+        re[i] += xr;
+        im[i] += xi;
+      }
+    }
+  }
+}
+
+
+
+// bandlimited rectangle (re) and sawtooth (im) with one inverse fft
+// both are sums of sin( n * arg ) / n, the rectangle with odd n only
+// Gibbs smoothing according:
+// Joe Wright: Synthesising bandlimited waveforms using wavetables
+// www.musicdsp.org/files/bandlimited.pdf
+//
+// spectrum of x + i * y with real x, y and sin partials a (x), b (y):
+// X[n] = ( b - i * a ) / 2, X[size-n] = ( -b + i * a ) / 2
+static void rect_saw_bl( double *re, double *im, unsigned int size, int partials ) {
+  if ( partials >= size / 2 )
+    partials = size / 2 - 1;
+  for ( unsigned int i = 0; i < size; i++ )
+    re[i] = im[i] = 0.0;
+  double k = M_PI / 2 / partials;
+  for ( int n = 1; n <= partials; n++ ) {
+    double m = cos( (n-1) * k );
+    m = m * m / n;
+    double a = n & 1 ? m : 0.0; // rectangle
+    double b = m;               // sawtooth
+    re[n] = b / 2;
+    im[n] = -a / 2;
+    re[size-n] = -b / 2;
+    im[size-n] = a / 2;
+  }
+  tg_fft( re, im, size, 1 );
+}
+
+
+
+// store one cycle as pairs of sample and slope to the next sample
+// the kernel interpolates sample + frac * slope with one load
+static void tg_pairs( sample_t *table, const double *cycle, unsigned int size ) {
+  for ( unsigned int i = 0; i < size; i++ ) {
+    table[2*i] = cycle[i];
+    table[2*i+1] = (sample_t)cycle[(i+1) & (size-1)] - (sample_t)cycle[i];
+  }
+}
+
+
+
+// build the reed and sharp octaves of a set (worker thread)
+// each octave is published as soon as it is ready
+static void *tg_gen_worker( void *arg ) {
+  tg_tables_t *tables = arg;
+  tg_ftz();
+  const unsigned int size = tables->size;
+  // fft buffer
+  double *re = (double *) malloc( 2 * size * sizeof( double ) );
+  double *im = re + size;
+  if ( re == NULL ) {
+    fprintf( stderr,"memory allocation failed\n" );
+    exit( 1 );
+  }
+  int oct;
+  while ( ( oct = __atomic_fetch_add( &tables->next, 1, __ATOMIC_RELAXED ) ) < OCT_SAMP ) {
+    sample_t *rd = tables->mem + oct * 2 * size;
+    sample_t *sh = tables->mem + ( OCT_SAMP + oct ) * 2 * size;
+    rect_saw_bl( re, im, size, tables->key.partials[ oct ] );
+    tg_pairs( rd, re, size ); // reed
+    tg_pairs( sh, im, size ); // sharp
+    __atomic_store_n( tables->rd + oct, rd, __ATOMIC_RELEASE );
+    __atomic_store_n( tables->sh + oct, sh, __ATOMIC_RELEASE );
+    // the last one writes the cache for the next start
+    // the rt thread keeps the malloc'ed tables
+    if ( 0 == __atomic_sub_fetch( &tables->left, 1, __ATOMIC_ACQ_REL ) ) {
+      if ( tables->store )
+        cache_unmap( &tables->key, cache_store( &tables->key, tables->mem ) );
+      tg_wake(); // hand over and premix the complete tables
+    }
+  }
+  free( re );
+  return NULL;
+}
+
+
+
+// a new set of tables for this sample rate and tuning (not rt)
+// returns after the flute table, reed and sharp follow in the background
+// and are written into the cache if store is set
+static tg_tables_t *tg_tables_new( unsigned int sample_rate, float pitch, int inton, int store )
+{
+  tg_tables_t *tables = (tg_tables_t *) calloc( 1, sizeof( tg_tables_t ) );
+  if ( tables == NULL ) {
+    fprintf( stderr,"memory allocation failed\n" );
+    exit( 1 );
+  }
+  tables->serial = ++tg_tables_serial;
+  tables->sample_rate = sample_rate;
+  tables->store = store;
+
+  // create 1 cycle of the wave
+  // the same number of samples at all sample rates up to TG_CYCLE_RATE
+  const unsigned int size = sample_rate > TG_CYCLE_RATE ? TG_CYCLE_MAX : TG_CYCLE;
+  tables->size = size;
+
+  // one size fits all (flute)
+  tables->fl = (sample_t *) malloc( 2 * size * sizeof( sample_t ) );
+  // exit if allocation failed
+  if ( tables->fl == NULL ) {
+    fprintf( stderr,"memory allocation failed\n" );
+    exit( 1 );
+  }
+
+  // calculate our scale multiplier
+  sample_t scale = 2 * M_PI / size;
+  // and fill it up with one period of sine wave
+  // maybe a RC filtered square wave sounds more natural
+  for ( int i=0; i < size; i++ ) {
+    tables->fl[2*i] = sinf( i * scale ); // flute
+  }
+  for ( int i=0; i < size; i++ ) {
+    tables->fl[2*i+1] = tables->fl[2*((i+1)%size)] - tables->fl[2*i];
+  }
+
+  // play the flute until reed and sharp are ready
+  for ( int oct = 0; oct < OCT_SAMP; oct++ )
+    tables->rd[ oct ] = tables->sh[ oct ] = tables->fl;
+
+  // reed and sharp voices
+  if ( CONNIE == connie_model ) {
+    // take them from the cache if we had this setup before
+    tables->key = (cache_key_t) {
+      .version = TG_CACHE_VERSION,
+      .sample_rate = sample_rate,
+      .model = connie_model,
+      .size = 2 * size,
+      .tables = 2 * OCT_SAMP
+    };
+    for ( int oct = 0; oct < OCT_SAMP; oct++ ) {
+      // max partial < sample_rate/2 for highest note in this octave
+      float f_max = tg_scale_freq[ inton ][ LOWNOTE + 12 * oct + 12 ] * pitch / 440.f;
+      tables->key.partials[ oct ] = sample_rate / 2.0 / f_max;
+    }
+    const sample_t *cycle = tables->map = cache_map( &tables->key );
+    if ( cycle ) {
+      for ( int oct = 0; oct < OCT_SAMP; oct++ ) {
+        tables->rd[ oct ] = cycle + oct * 2 * size;
+        tables->sh[ oct ] = cycle + ( OCT_SAMP + oct ) * 2 * size;
+      }
+    } else {
+      // allocate the space needed to store one cycle
+      // use own buffer for each octave (reed and sharp voice)
+      tables->mem = (sample_t *) malloc( 2 * OCT_SAMP * 2 * size * sizeof( sample_t ) );
+      if ( tables->mem == NULL ) {
+        fprintf( stderr,"memory allocation failed\n" );
+        exit( 1 );
+      }
+      // fill sample buffers with bandlimited waves in the background
+      tables->next = 0;
+      tables->left = OCT_SAMP;
+      long cpus = sysconf( _SC_NPROCESSORS_ONLN );
+      if ( cpus > OCT_SAMP )
+        cpus = OCT_SAMP;
+      for ( tables->workers = 0; tables->workers < cpus; tables->workers++ ) {
+        if ( pthread_create( tables->worker + tables->workers, NULL, tg_gen_worker, tables ) )
+          break;
+      }
+      // no threads, do it now
+      if ( !tables->workers )
+        tg_gen_worker( tables );
+    }
+  } // if ( CONNIE )
+
+  return tables;
+} // tg_tables_new()
+
+
+
+// new tables if sample rate or tuning have changed (not rt)
+// the rt thread takes them at the first block after they are complete
+static void tg_tables_update( unsigned int sample_rate, float pitch, int inton, int store )
+{
+  pthread_mutex_lock( &tg_tables_lock );
+  // not yet initialized or nothing to do
+  if ( tg_tables_rate && ( sample_rate != tg_tables_rate
+       || pitch != tg_tables_pitch || inton != tg_tables_inton ) ) {
+    tg_tables_rate = sample_rate;
+    tg_tables_pitch = pitch;
+    tg_tables_inton = inton;
+    // an unfinished set is not used by the rt thread, drop it
+    if ( tg_tables_building )
+      tg_tables_free( tg_tables_latest );
+    tg_tables_latest = tg_tables_new( sample_rate, pitch, inton, store );
+    tg_tables_building = 1;
+    // from the cache it is complete already
+    tg_tables_handover();
+  }
+  pthread_mutex_unlock( &tg_tables_lock );
+} // tg_tables_update()
+
+
+
+// the sample rate has changed (not rt)
+// the new tables are used from the next block on
+void tg_set_rate( unsigned int sample_rate )
+{
+  tg_sample_rate = sample_rate;
+  pthread_mutex_lock( &tg_tables_lock );
+  float pitch = tg_tables_pitch;
+  int inton = tg_tables_inton;
+  pthread_mutex_unlock( &tg_tables_lock );
+  tg_tables_update( sample_rate, pitch, inton, 1 );
+} // tg_set_rate()
+
+
+
+void tg_init( unsigned int sample_rate )
+{
+  tg_sample_rate = sample_rate;
+
+  // build list of eq. tuned midi frequencies starting from lowest C (note 0)
+  // (three halftones above the very low A six octaves down from a' 440 Hz)
+  // for all scales, concert_pitch is applied by the rt thread
+  if ( !tg_scale_freq )
+    tg_scale_freq = malloc( NSCALES * sizeof( *tg_scale_freq ) );
+  if ( tg_scale_freq == NULL ) {
+    fprintf( stderr,"memory allocation failed\n" );
+    exit( 1 );
+  }
+  for ( int scale = 0; scale < NSCALES; scale++ ) {
+    float low_C = 440.0 / 32.0 / scales[scale].f_ratio[9];
+    // build a list of intonation frequencies
+    // alternative tunings are possible
+    for ( int midinote = 0; midinote < MIDI_MAX; midinote++ ) {
+      int tone = midinote % 12; // C, C#, D,..., B
+      int fmult = 1 << (midinote / 12); // doubles every octave
+      tg_scale_freq[ scale ][ midinote ] = scales[scale].f_ratio[ tone ] * low_C * fmult;
+    } // for ( midinote )
+  } // for ( scale )
+
+  // all keys of all divisions off
+  if ( tg_divisions < 1 )
+    tg_divisions = 1;
+  else if ( tg_divisions > TG_DIVISIONS )
+    tg_divisions = TG_DIVISIONS;
+  memset( tg_div, 0, sizeof( tg_div ) );
+  for ( int d = 0; d < TG_DIVISIONS; d++ ) {
+    tg_div[d].master_vol = tg_master_vol;
+    reverb_init( &tg_div[d].rev, sample_rate );
+  }
+  tg_plays = 0;
+  tg_fdn_lines = 0;
+  tg_reverb_rate = sample_rate;
+
+  // two empty premixes for each division, one in use, one free
+  if ( !tg_premix_mem )
+    tg_premix_mem = malloc( 2 * TG_DIVISIONS * sizeof( tg_premix_t ) );
+  if ( tg_premix_mem == NULL ) {
+    fprintf( stderr,"memory allocation failed\n" );
+    exit( 1 );
+  }
+  for ( int d = 0; d < TG_DIVISIONS; d++ ) {
+    tg_div[d].premix = tg_premix_mem + 2 * d;
+    tg_div[d].premix->key.serial = 0;
+    tg_premix_free[d] = tg_premix_mem + 2 * d + 1;
+    tg_premix_next[d] = NULL;
+    tg_premix_done[d].serial = 0;
+  }
+
+  // set the starting phase of the 12 tones
+  for ( int tone = 0; tone < 12; tone++ ) {
+    tg_sample_offset[ tone ] = 0.0;
+  }
+
+  // the sample rate dependent tables
+  printf( "Preparing the voices" );
+  tg_tables_latest = tg_tables_new( sample_rate, concert_pitch, intonation, 1 );
+  tg_tables_building = 0;
+  tg_tables_use( tg_tables_latest );
+  tg_tables_rate = sample_rate;
+  tg_tables_pitch = concert_pitch;
+  tg_tables_inton = intonation;
+  tg_publish();
+
+  // sin**2 for smoothing the steps
+  for ( int vol = 0; vol <= VOL_RAW_MAX; vol++ ) {
+    soft_step[ vol ] = VOL_RAW_MAX * ( 0.5 - 0.5 * cosf( M_PI * vol / VOL_RAW_MAX ) ) + 0.5f;
+    soft_step[ vol + VOL_RAW_MAX ] = vol + VOL_RAW_MAX;
+  }
+  puts("");
+}
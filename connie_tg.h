@@ -24,6 +24,38 @@
 #ifndef CONNIE_TG_H
 #define CONNIE_TG_H
 
+#include <stddef.h>
+
+// the tonegen, independent of jack
+
+typedef float sample_t;
+
+// the current sample rate
+extern unsigned int tg_sample_rate;
+
+// type of instrument
+extern model_t connie_model;
+
+// the intonation scales
+extern const int NSCALES;
+extern const char *tg_scale_name( int scale );
+
+// divisions: manuals and pedalboard in one process, each with its own
+// midi channel, key range, drawbars and outputs, sharing the tables
+// and the oscillator phases (and with them tuning, pitch bend and vibrato)
+#define TG_DIVISIONS 3
+// 1..TG_DIVISIONS, set before tg_init()
+extern int tg_divisions;
+// midi channel (1..16, 0=all) and key range (midi notes) of each division
+extern int tg_div_channel[TG_DIVISIONS];
+extern int tg_div_low[TG_DIVISIONS];
+extern int tg_div_high[TG_DIVISIONS];
+// "upper", "lower", "pedal"
+extern const char *tg_div_name( int division );
+
+// the division the stops, voices and effects below belong to (ui side)
+extern int tg_division;
+
 // stops
 extern float tg_vol[9];
 
@@ -32,10 +64,10 @@ extern float tg_vol_fl;
 extern float tg_vol_rd;
 extern float tg_vol_sh;
 
-// master volume
+// master volume, start value of each division, then midi cc 7
 extern float tg_master_vol;
 
-// vibrato frequency
+// vibrato frequency, the fastest of all divisions is used
 extern float tg_vibrato;
 
 // percussion intensity
@@ -44,8 +76,73 @@ extern float tg_percussion;
 // reverb intensity
 extern float tg_reverb;
 
+// reverb type of all divisions: 0 = mono jcrev, 4, 8, 16 = stereo fdn with that many lines
+extern int tg_reverb_lines;
+
+// publish the values above for tg_division and the tuning (connie.h) to the
+// rt thread, taken at the next block, new tables follow in the background
+extern void tg_publish( void );
+
 // all sound off
 extern void tg_panic( void );
 
+// commands between the ui and the rt thread
+#define TG_CMD_PANIC 1      // ui -> rt
+#define TG_CMD_PROGRAM 2    // rt -> ui, arg: division << 8 | midi program
+#define TG_CMD_INTONATION 3 // rt -> ui, arg: cc value
+#define TG_CMD_PITCH 4      // rt -> ui, arg: cc value
+#define TG_CMD_TRANSPOSE 5  // rt -> ui, arg: cc value
+// get the next command, returns 0 if none
+extern int tg_get_cmd( int *cmd, int *arg );
+
+// midi cc for the tuning, the ui sets intonation, concert_pitch and transpose
+#define TG_CC_INTONATION 14 // scale 0..NSCALES-1
+#define TG_CC_PITCH 15      // concert pitch 440 + ( value - 64 ) / 2 Hz
+#define TG_CC_TRANSPOSE 16  // value - 64 semitones, -12..+12
+
+// build the tables for this sample rate
+// returns after the flute table, reed and sharp are built in the background
+// and sound like the flute until their octave is ready
+extern void tg_init( unsigned int sample_rate );
+
+// wait until all tables are built (not while the rt thread runs)
+extern void tg_wait( void );
+
+// call in the ui thread after changes and wake ups, premixes the voices
+// for the drawbars when the tables built in the background are ready,
+// never waits for the rt thread
+extern void tg_idle( void );
+
+// the ui sleeps: write to this eventfd when tg_idle() has work
+// (background tables ready) or a jack session event came in
+// -1: off (default), the ui polls
+// the rt thread never writes it: commands for tg_get_cmd() (midi program
+// change or tuning cc) are found by polling while midi is connected
+extern void tg_notify( int fd );
+// write to that eventfd, from any thread but the rt thread
+extern void tg_wake( void );
+
+// the sample rate has changed, rebuild the tables in the background
+// and swap them in at a block start, phases are kept
+extern void tg_set_rate( unsigned int sample_rate );
+
+// mix the notes in this many threads (the rt thread and threads-1 workers),
+// up to the number of cpus, 1: off (default)
+// priority: SCHED_FIFO priority of the workers, 0: normal scheduling
+// call after tg_init(), not while the rt thread runs
+extern void tg_threads( int threads, int priority );
+
+// stop the note threads, free the tables
+extern void tg_shutdown( void );
+
+// process one midi event (2 or 3 bytes)
+extern void tg_midi_in( const unsigned char *buffer, size_t size );
+
+// render nframes of audio with the actual state
+// out[2*d] and out[2*d+1]: left and right output of division d,
+// written from offset on
+// call tg_midi_in() between two tg_render() at the event's time
+extern void tg_render( sample_t *const *out, unsigned int offset, unsigned int nframes );
+
 
 #endif
@@ -38,6 +38,9 @@
 #include "connie.h"
 #include "connie_tg.h"
 #include "connie_ui.h"
+#include "connie_prof.h"
+#include "connie_screen.h"
+#include "reverb.h"
 
 
 // **********************************************************
@@ -64,7 +67,7 @@ typedef struct {
 // our model 0, the original connie
 #define STOPS_0 4
 #define DRAWBARS_0 10
-int ui_draw_0[DRAWBARS_0] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+int ui_draw_0[TG_DIVISIONS][DRAWBARS_0]; // each division
 ui_t ui_ui_0[DRAWBARS_0] = {
   { " 16  ", 'Q', 'A' }, // stops
   { "  8  ", 'W', 'S' }, //   " 
@@ -104,7 +107,7 @@ static int ui_preset_0[PRESETS_0][DRAWBARS_0] = {
 // the test model with individual drawbars for each tonegen stop
 #define STOPS_1 9
 #define DRAWBARS_1 (STOPS_1+3)
-int ui_draw_1[DRAWBARS_1] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+int ui_draw_1[TG_DIVISIONS][DRAWBARS_1]; // each division
 ui_t ui_ui_1[DRAWBARS_1] = {
   { " 16  ", 'Q', 'A' }, // stops
   { "5 1/3", 'W', 'S' }, //   " 
@@ -140,7 +143,7 @@ static int ui_preset_1[PRESETS_1][DRAWBARS_1] = {
 };
 
 // some ugly globals, fn pointer, etc.
-static int *ui_draw = ui_draw_0;
+static int *ui_draw = ui_draw_0[0]; // of tg_division
 static ui_t *ui_ui = ui_ui_0;
 static int *ui_colors = ui_colors_0;
 static int ui_drawbars = DRAWBARS_0;
@@ -165,6 +168,7 @@ static void ui_set_volumes_0( void ) {
   tg_percussion = ui_draw[7] / 8.0;
   tg_vibrato    = ui_draw[8] / 8.0;
   tg_reverb     = ui_draw[9] * ui_draw[9] / 64.0;
+  tg_publish();
 }
 
 static void ui_set_volumes_1( void ) {
@@ -180,6 +184,7 @@ static void ui_set_volumes_1( void ) {
   tg_vol_fl     = 1.0;
   tg_vol_rd     = 0.0;
   tg_vol_sh     = 0.0;
+  tg_publish();
 }
 
 
@@ -191,7 +196,7 @@ static void ui_set_model( model_t model ) {
   switch ( model ) {
     default:
     case CONNIE:
-      ui_draw = ui_draw_0;
+      ui_draw = ui_draw_0[tg_division];
       ui_ui = ui_ui_0;
       ui_drawbars = DRAWBARS_0;
       ui_colors = ui_colors_0;
@@ -201,7 +206,7 @@ static void ui_set_model( model_t model ) {
       ui_connie_model = CONNIE;
       break;
     case HAMMOND:
-      ui_draw = ui_draw_1;
+      ui_draw = ui_draw_1[tg_division];
       ui_ui = ui_ui_1;
       ui_drawbars = DRAWBARS_1;
       ui_colors = ui_colors_1;
@@ -214,6 +219,17 @@ static void ui_set_model( model_t model ) {
 }
 
 
+// the division the drawbars and programs belong to
+void ui_set_division( int division ) {
+  if ( division < 0 || division >= tg_divisions )
+    return;
+  tg_division = division;
+  ui_draw = CONNIE == ui_connie_model ? ui_draw_0[division] : ui_draw_1[division];
+  ui_set_volumes(); // the stops of this division for the next tg_publish()
+  ui_value_changed = 1;
+}
+
+
 // set drawbars according to presets
 int ui_set_program( int prog ) {
   switch ( ui_connie_model ){
@@ -243,9 +259,17 @@ int ui_set_program( int prog ) {
 }
 
 
+// number of presets of the actual model
+int ui_get_presets( void ) {
+  return ui_presets;
+}
+
+
 // set drawbars according to init values
 int ui_set_drawbars( const int *draws ) {
-  for ( int i = 0; i < draws[0]; i++ ) {
+  // more values than drawbars of this model are ignored
+  const int count = draws[0] < ui_drawbars ? draws[0] : ui_drawbars;
+  for ( int i = 0; i < count; i++ ) {
     ui_draw[i]    = draws[i+1];
   }
   ui_set_volumes();
@@ -254,6 +278,16 @@ int ui_set_drawbars( const int *draws ) {
 }
 
 
+// the drawbars of the actual division, same format
+int ui_get_drawbars( int *draws ) {
+  draws[0] = ui_drawbars;
+  for ( int i = 0; i < ui_drawbars; i++ ) {
+    draws[i+1] = ui_draw[i];
+  }
+  return 0;
+}
+
+
 
 // keyboard translation for QWERTY, QWERTZ and AZERTY
 static char kbd_translate_QWERTY( char c ) {
@@ -304,69 +338,205 @@ static void ui_set_kbd( keybd_t kbd ) {
 }
 
 
-// explain the user interface
-static void print_help( const char *name ) {
-  printf( "\n\n\n\n\n" );
-  printf( "   %s: %s (%s), %s, %5.1f Hz\n\n", 
-        jack_name, connie_version, name, inton_name, concert_pitch );
-  printf( "   [ESC]\t\t\t\tQUIT\n   [SPACE]\t\t\t\tPANIC\n" );
-  printf( "   %c%c%c%c%c%c... and %c%c%c%c%c%c... \t\tStops\n   ", 
+// retune, the values are clamped like the command line options
+void ui_set_tuning( int inton, float pitch, int trans ) {
+  if ( inton < 0 )
+    inton = 0;
+  else if ( inton >= NSCALES )
+    inton = NSCALES - 1;
+  if ( pitch < 220 )
+    pitch = 220;
+  else if ( pitch > 880 )
+    pitch = 880;
+  if ( trans < -12 )
+    trans = -12;
+  else if ( trans > 12 )
+    trans = 12;
+  intonation = inton;
+  inton_name = tg_scale_name( intonation );
+  concert_pitch = pitch;
+  transpose = trans;
+  tg_publish();
+  ui_value_changed = 1;
+}
+
+
+
+// a command from the rt thread (midi)
+void ui_command( int cmd, int arg ) {
+  switch ( cmd ) {
+    case TG_CMD_PROGRAM: // of another division maybe
+      {
+        int division = tg_division;
+        ui_set_division( arg >> 8 );
+        ui_set_program( arg & 0xff );
+        ui_set_division( division );
+      }
+      break;
+    case TG_CMD_INTONATION:
+      ui_set_tuning( arg, concert_pitch, transpose );
+      break;
+    case TG_CMD_PITCH:
+      ui_set_tuning( intonation, 440 + ( arg - 64 ) / 2.0, transpose );
+      break;
+    case TG_CMD_TRANSPOSE:
+      ui_set_tuning( intonation, concert_pitch, arg - 64 );
+      break;
+  }
+}
+
+
+
+// the last dsp load line, shown in each frame
+static char ui_load[256] = "";
+
+// a redraw was asked for, taken at the next frame time
+// 1: the changed cells, 2: all at once (^L)
+static int ui_redraw = 0;
+
+// ask for quit in the frame
+static int ui_quit_ask = 0;
+
+// at most 25 frames per second, drawbar sweeps are not drawn step by step
+#define UI_FRAME_MS 40
+
+
+
+// explain the user interface, returns the next free row
+static int print_help( int row, const char *name ) {
+  screen_print( row++, 0, WHITE, "   %s: %s (%s), %s, %5.1f Hz, transpose %+d",
+        jack_name, connie_version, name, inton_name, concert_pitch, transpose );
+  row++;
+  screen_print( row++, 0, WHITE, "   [ESC]\t\t\t\tQUIT" );
+  screen_print( row++, 0, WHITE, "   [SPACE]\t\t\t\tPANIC" );
+  screen_print( row++, 0, WHITE, "   [ and ]  - and +  < and >\t\tScale, Pitch, Transpose" );
+  if ( tg_divisions > 1 )
+    screen_print( row++, 0, WHITE, "   [TAB]\t\t\t\tDivision: %s, channel %d, keys %d..%d",
+                  tg_div_name( tg_division ), tg_div_channel[tg_division],
+                  tg_div_low[tg_division], tg_div_high[tg_division] );
+  if ( tg_reverb_lines )
+    screen_print( row++, 0, WHITE, "   [/]\t\t\t\t\tReverb: stereo, %d lines", tg_reverb_lines );
+  else
+    screen_print( row++, 0, WHITE, "   [/]\t\t\t\t\tReverb: mono" );
+  screen_print( row++, 0, WHITE, "   %c%c%c%c%c%c... and %c%c%c%c%c%c... \t\tStops",
           kbd_translate( 'Q' ), kbd_translate( 'W' ),
           kbd_translate( 'E' ), kbd_translate( 'R' ),
           kbd_translate( 'T' ), kbd_translate( 'Y' ),
           kbd_translate( 'A' ), kbd_translate( 'S' ),
           kbd_translate( 'D' ), kbd_translate( 'F' ),
           kbd_translate( 'G' ), kbd_translate( 'H' ) );
+  int col = 3;
   for ( int i = 0; i < ui_presets; i++ ) {
-    printf( "%d  ", i );
+    col = screen_print( row, col, WHITE, "%d  ", i );
   }
-  for ( int i = ui_presets; i < 10; i++ ) {
-    printf( "   " );
+  screen_print( row++, 3 + 3 * 10, WHITE, "\tPresets" );
+  return row + 1;
+}
+
+
+// the dsp load since the last call (and the reverb denormal count)
+// into ui_load, shown with the next frame
+#if defined( CONNIE_PROFILE ) || defined( CONNIE_DENORMAL )
+static void print_load( void ) {
+  int len = 0;
+#ifdef CONNIE_PROFILE
+  static prof_stat_t last;
+  prof_stat_t now;
+  prof_read( &now );
+  unsigned long long deadline = now.deadline - last.deadline;
+  unsigned long long periods = now.periods - last.periods;
+  if ( !deadline || !periods )
+    return;
+  len += snprintf( ui_load + len, sizeof( ui_load ) - len, "   dsp load:" );
+  for ( int stage = 0; stage <= PROF_STAGES; stage++ ) {
+    len += snprintf( ui_load + len, sizeof( ui_load ) - len, " %s %.1f%%", prof_name[stage],
+                     100.0 * ( now.cycles[stage] - last.cycles[stage] ) / deadline );
+  }
+  // p99 of the total load from the histogram
+  unsigned long long count = 0;
+  int bin = 0;
+  for ( ; bin < PROF_BINS - 1; bin++ ) {
+    count += now.hist[PROF_TOTAL][bin] - last.hist[PROF_TOTAL][bin];
+    if ( count * 100 >= periods * 99 )
+      break;
   }
-  printf( "\tPresets\n\n");
+  if ( bin < PROF_BINS - 1 )
+    len += snprintf( ui_load + len, sizeof( ui_load ) - len, ", p99 < %.1f%%", ( 1 << bin ) / 10.0 );
+  else
+    len += snprintf( ui_load + len, sizeof( ui_load ) - len, ", p99 OVERLOAD" );
+  last = now;
+#endif
+#ifdef CONNIE_DENORMAL
+#ifndef CONNIE_PROFILE
+  len += snprintf( ui_load + len, sizeof( ui_load ) - len, "  " );
+#endif
+  len += snprintf( ui_load + len, sizeof( ui_load ) - len, " denormals: %llu", reverb_denormals() );
+#endif
 }
+#endif
 
 
-// show drawbars
-static void print_status( void ) {
+
+// show drawbars, returns the next free row
+static int print_status( int row ) {
+  int col;
   // the headline
-  printf( "    " );
+  col = screen_print( row, 0, WHITE, "    " );
   for ( int i = 0; i < ui_drawbars; i++ )
-    printf( "______" );
-  printf( "\b \n" );
+    col = screen_print( row, col, WHITE, i < ui_drawbars - 1 ? "______" : "_____" );
+  row++;
   // drawbar names
-  printf( "   |" );
+  col = screen_print( row, 0, WHITE, "   |" );
   for ( int i = 0; i < ui_drawbars; i++ ) {
-    printf( "\e[%dm%s\e[0m|", ui_colors[i], ui_ui[i].name );
+    col = screen_print( row, col, ui_colors[i], "%s", ui_ui[i].name );
+    col = screen_print( row, col, WHITE, "|" );
   }
-  printf( "\n" );
+  row++;
   // drawbar up cmd
-  printf( "   |" );
+  col = screen_print( row, 0, WHITE, "   |" );
   for ( int i = 0; i < ui_drawbars; i++ ) {
-    printf( " \e[%dm[%c]\e[0m |", ui_colors[i], kbd_translate( ui_ui[i].up ) );
+    col = screen_print( row, col + 1, ui_colors[i], "[%c]", kbd_translate( ui_ui[i].up ) );
+    col = screen_print( row, col, WHITE, " |" );
   }
-  printf( "\n" );
+  row++;
   // drawbar values
-  printf( "   |" );
+  col = screen_print( row, 0, WHITE, "   |" );
   for ( int i = 0; i < ui_drawbars; i++ ) {
-    printf( "__\e[%dm%d\e[0m__|", ui_colors[i], ui_draw[i] );
+    col = screen_print( row, col, WHITE, "__" );
+    col = screen_print( row, col, ui_colors[i], "%d", ui_draw[i] );
+    col = screen_print( row, col, WHITE, "__|" );
   }
-  printf( "\b|\n" );
+  row++;
   // the drawbars
-  for ( int line = 0; line < 8; line++ ) {
-    printf( "   |" );
+  for ( int line = 0; line < 8; line++, row++ ) {
+    col = screen_print( row, 0, WHITE, "   |" );
     for ( int i = 0; i < ui_drawbars; i++ ) {
-      printf( " \e[%dm%s\e[0m  ", ui_colors[i], ui_draw[i]>line?"###":"   " );
+      col = screen_print( row, col + 1, ui_colors[i], "%s", ui_draw[i]>line?"###":"   " );
+      col = screen_print( row, col, WHITE, i < ui_drawbars - 1 ? "  " : " |" );
     }
-    printf( "\b|\n" );
   }
   // drawbar down cmd
-  printf( "   |" );
+  col = screen_print( row, 0, WHITE, "   |" );
   for ( int i = 0; i < ui_drawbars; i++ ) {
-    printf( "_\e[%dm[%c]\e[0m__", ui_colors[i], kbd_translate( ui_ui[i].dn ) );
+    col = screen_print( row, col, WHITE, "_" );
+    col = screen_print( row, col, ui_colors[i], "[%c]", kbd_translate( ui_ui[i].dn ) );
+    col = screen_print( row, col, WHITE, i < ui_drawbars - 1 ? "__" : "_|" );
   }
-  printf( "\b|\n\n" );
-  fflush( stdout );
+  row += 2;
+  screen_print( row++, 0, WHITE, "%s", ui_load );
+  return row;
+}
+
+
+
+// draw the whole ui into the screen model, the terminal gets the changes
+static void print_frame( const char *name, int full ) {
+  screen_begin();
+  int row = print_help( 0, name );
+  row = print_status( row );
+  if ( ui_quit_ask )
+    screen_print( row, 0, WHITE, "QUIT? [y/N] :" );
+  screen_flush( full );
 }
 
 
@@ -377,9 +547,9 @@ static struct termios ui_term_orig;
 // called via atexit()
 static void ui_shutdown( void )
 {
+  screen_exit();
   // restore original term settings
   tcsetattr( 1, 0, &ui_term_orig );
-  printf("\n");
 }
 
 
@@ -430,6 +600,61 @@ void ui_save( int type, const char *path ) {
       ui_status = 0;
       break;
   }
+  // the daemon sleeps until it is told
+  tg_wake();
+}
+
+
+
+// write the session file when jack session (or quit) asks for it
+// returns 1 if connie shall quit
+int ui_session( void ) {
+  int status = ui_status;
+  switch ( status ) {
+    case 0:
+      return 0;
+    case 2:
+      break;
+    default:
+      ui_status = 0;
+      break;
+  }
+  FILE *cfg = fopen( ".connie_session", "w" );
+  fprintf( cfg, "###########################\n" );
+  fprintf( cfg, "### connie session file ###\n" );
+  fprintf( cfg, "###########################\n\n" );
+  if ( uuid )
+    fprintf( cfg, "UUID = \"%s\"\n", uuid );
+  fprintf( cfg, "jack_name = \"%s\"\n", jack_name );
+  fprintf( cfg, "connie_model = %d\n", ui_connie_model );
+  fprintf( cfg, "keybd = %d\n", ui_kbd );
+  fprintf( cfg, "intonation = %d\n", intonation );
+  fprintf( cfg, "concert_pitch = %f\n", concert_pitch );
+  fprintf( cfg, "transpose = %d\n", transpose );
+  fprintf( cfg, "midi_channel = %d\n", tg_midi_channel );
+  fprintf( cfg, "reverb_lines = %d\n", tg_reverb_lines );
+  fprintf( cfg, "divisions = %d\n", tg_divisions );
+  fprintf( cfg, "midi_channels = { " );
+  for ( int div = 0; div < tg_divisions; div++ )
+    fprintf( cfg, "%d, ", tg_div_channel[div] );
+  fprintf( cfg, "}\n" );
+  fprintf( cfg, "key_range = { " );
+  for ( int div = 0; div < tg_divisions; div++ )
+    fprintf( cfg, "%d, %d, ", tg_div_low[div], tg_div_high[div] );
+  fprintf( cfg, "}\n" );
+  for ( int div = 0; div < tg_divisions; div++ ) {
+    const int *draw = CONNIE == ui_connie_model ? ui_draw_0[div] : ui_draw_1[div];
+    if ( div )
+      fprintf( cfg, "%s_", tg_div_name( div ) );
+    fprintf( cfg, "drawbars = { " );
+    for ( int iii=0; iii < ui_drawbars; iii++ ) {
+      fprintf( cfg, "%d, ", draw[iii] );
+    }
+    fprintf( cfg, "}\n" );
+  }
+  fclose( cfg );
+  printf( "ui_status = %d, session_dir = %s\n", ui_status, session_dir );
+  return 2 == status;
 }
 
 
@@ -446,14 +671,29 @@ void ui_init( const int connie_model, const keybd_t kbd ) {
   // set keyboard to non canonical mode
   t.c_lflag &= ~(ICANON | ECHO);
   tcsetattr (1, 0, &t);
+  // kbhit() looks at the fd, so no keys may wait in the stdio buffer
+  setvbuf( stdin, NULL, _IONBF, 0 );
   atexit( ui_shutdown ); // tidy up
+  screen_init();
+
+  ui_setup( connie_model, kbd );
+}
+
+
+
+// model, keyboard and program 0 without terminal (offline rendering)
+void ui_setup( const int connie_model, const keybd_t kbd ) {
 
   ui_connie_model = connie_model;
   ui_kbd = kbd;
 
   ui_set_kbd( kbd ); // QWERTY, QWERTZ or AZERTY
   ui_set_model( connie_model ); // 
-  ui_set_program( 0 );
+  // program 0 for all divisions, edit the first one
+  for ( int division = tg_divisions - 1; division >= 0; division-- ) {
+    ui_set_division( division );
+    ui_set_program( 0 );
+  }
 }
 
 
@@ -461,21 +701,42 @@ void ui_init( const int connie_model, const keybd_t kbd ) {
 void ui_loop( const char *name ) {
 
   int cmd;
+  long frame_ms = 0; // time of the last frame
 
   while ( 2 != ui_status ) {
+    // commands from the rt thread
+    int tg_cmd, tg_arg;
+    while ( tg_get_cmd( &tg_cmd, &tg_arg ) )
+      ui_command( tg_cmd, tg_arg );
     if ( kbhit() ) {
       cmd = kbd_translate( toupper( getchar() ) );
       if ( ' ' == cmd ) { // SPACE -> panic
         tg_panic();
         ui_value_changed++;
       } else if ( '\033' == cmd ) { // ESC -> QUIT
-        printf( "QUIT? [y/N] :" );
+        ui_quit_ask = 1;
+        print_frame( name, 0 );
         cmd = getchar();
-        putchar( cmd );
+        ui_quit_ask = 0;
         if ( 'y' == cmd || 'Y' == cmd )
           ui_status = 2;
         else
           ui_value_changed++; // force redraw
+      } else if ( '\f' == cmd ) { // ^L -> repaint after foreign output
+        ui_redraw = 2;
+      } else if ( '[' == cmd || ']' == cmd ) { // scale
+        ui_set_tuning( intonation + ( '[' == cmd ? -1 : 1 ), concert_pitch, transpose );
+      } else if ( '-' == cmd || '+' == cmd || '=' == cmd ) { // pitch in 0.5 Hz steps
+        ui_set_tuning( intonation, concert_pitch + ( '-' == cmd ? -0.5 : 0.5 ), transpose );
+      } else if ( '<' == cmd || '>' == cmd || ',' == cmd || '.' == cmd ) { // transpose
+        ui_set_tuning( intonation, concert_pitch,
+                       transpose + ( '<' == cmd || ',' == cmd ? -1 : 1 ) );
+      } else if ( '\t' == cmd ) { // next division
+        ui_set_division( ( tg_division + 1 ) % tg_divisions );
+      } else if ( '/' == cmd ) { // reverb: mono, 4, 8, 16 lines
+        tg_reverb_lines = tg_reverb_lines >= 16 ? 0 : tg_reverb_lines ? 2 * tg_reverb_lines : 4;
+        tg_publish();
+        ui_value_changed++;
       } else if ( isdigit( cmd ) ) { // number -> set prog
         ui_set_program( cmd - '0' );
         //ui_value_changed++;
@@ -499,43 +760,34 @@ void ui_loop( const char *name ) {
     } 
     if ( ui_value_changed ) {
       ui_set_volumes();
-      print_help( name );
-      print_status();
       ui_value_changed = 0;
+      if ( !ui_redraw )
+        ui_redraw = 1;
     } else {
+      tg_idle();
       usleep( 10000 );
+#if defined( CONNIE_PROFILE ) || defined( CONNIE_DENORMAL )
+      static int load_timer = 0;
+      if ( ++load_timer >= 50 ) { // update twice a second
+        load_timer = 0;
+        print_load();
+        if ( !ui_redraw )
+          ui_redraw = 1;
+      }
+#endif
     }
-    switch ( ui_status ) {
-      default:
-      case 1:
-      case 3:
-        ui_status = 0;
-      case 2:
-        {
-          FILE *cfg = fopen( ".connie_session", "w" );
-          fprintf( cfg, "###########################\n" );
-          fprintf( cfg, "### connie session file ###\n" );
-          fprintf( cfg, "###########################\n\n" );
-          if ( uuid )
-            fprintf( cfg, "UUID = \"%s\"\n", uuid );
-          fprintf( cfg, "jack_name = \"%s\"\n", jack_name );
-          fprintf( cfg, "connie_model = %d\n", ui_connie_model );
-          fprintf( cfg, "keybd = %d\n", ui_kbd );
-          fprintf( cfg, "intonation = %d\n", intonation );
-          fprintf( cfg, "concert_pitch = %f\n", concert_pitch );
-          fprintf( cfg, "transpose = %d\n", transpose );
-          fprintf( cfg, "midi_channel = %d\n", tg_midi_channel );
-          fprintf( cfg, "drawbars = { " );
-          for ( int iii=0; iii < ui_drawbars; iii++ ) {
-            fprintf( cfg, "%d, ", ui_draw[iii] );
-          }
-          fprintf( cfg, "}\n" );
-          fclose( cfg );
-          printf( "ui_status = %d, session_dir = %s\n", ui_status, session_dir );
-        }
-      case 0:
-        break;
+    // the changes since the last frame, at most every UI_FRAME_MS
+    if ( ui_redraw ) {
+      struct timespec now;
+      clock_gettime( CLOCK_MONOTONIC, &now );
+      long now_ms = now.tv_sec * 1000 + now.tv_nsec / 1000000;
+      if ( now_ms - frame_ms >= UI_FRAME_MS || ui_redraw > 1 ) {
+        print_frame( name, ui_redraw > 1 );
+        ui_redraw = 0;
+        frame_ms = now_ms;
+      }
     }
+    ui_session();
   } //while 2 != ui_status
 } // connie_ui()
 
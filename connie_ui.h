@@ -28,10 +28,22 @@
 
 typedef enum keybd_enum { QWERTY=0, QWERTZ, AZERTY } keybd_t;
 
+// the division ui_set_program() and ui_set_drawbars() work on
+extern void ui_set_division( int division );
 extern int ui_set_program( int prog );
+// draw[0]: number of drawbars, then their values 0..8
 extern int ui_set_drawbars( const int *draw );
+extern int ui_get_drawbars( int *draw );
+extern int ui_get_presets( void );
 extern void ui_save( int type, const char *path );
+// write the session file if ui_save() or quit asked for it, 1: quit
+extern int ui_session( void );
 extern void ui_init( const int connie_model, const keybd_t keybd );
+extern void ui_setup( const int connie_model, const keybd_t keybd );
 extern void ui_loop( const char *name );
+// scale, concert pitch and transpose, clamped to their ranges
+extern void ui_set_tuning( int inton, float pitch, int trans );
+// handle a command from tg_get_cmd()
+extern void ui_command( int cmd, int arg );
 
 #endif
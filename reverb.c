@@ -26,9 +26,10 @@
 
 
 #include <stdlib.h>
-#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
 #include <math.h>
-#include <linux/types.h>
 
 #include "reverb.h"
 
@@ -36,9 +37,21 @@
 // -> ccrma.stanford.edu/~jos/pasp/Schroeder_Reverberator_called_JCRev.html
 // JCRev uses 3 all pass filtes in series
 // and 4 parallel feed forward comb filters
-// to replace the FFCF with IIR filters uncomment next line
-
-// #define IIR
+// to replace the FFCF with IIR filters define IIR in reverb.h
+//
+// processed in chunks of up to REVERB_BLOCK frames:
+// all delays are longer than a chunk, so each stage reads the whole
+// chunk from its delay line, works on plain arrays (the compiler
+// vectorizes these loops) and writes the chunk back.
+// the delay lines are powers of 2 and wrap by mask, a chunk that
+// crosses the end is copied in two parts.
+// the output feedback comes from the frame before, as in the per sample
+// code. it reaches the combs through the all passes without delay, the
+// filters are linear: the feedback part is added frame by frame together
+// with the lowpass, everything else is computed over the whole chunk
+
+// all delays in frames at REVERB_RATE, scaled to the sample rate
+// by reverb_init() and fdn_init()
 
 // three all pass filters
 // ======================
@@ -47,44 +60,37 @@
 #define NA2  337
 #define NA3  113
 // gain
-#define GA1 0.707
-#define GA2 0.707
-#define GA3 0.707
-// delay lines
-static float ap1[NA1];
-static float ap2[NA2];
-static float ap3[NA3];
-// position in delay line
-static int ia1;
-static int ia2;
-static int ia3;
+#define GA1 0.707f
+#define GA2 0.707f
+#define GA3 0.707f
 
 
 // four comb filters
 // =================
 #ifndef IIR
 // length of delay line
+// all feed forward combs see the same input: one line with four taps
 #define NC1 4799
 #define NC2 4999
 #define NC3 5399
 #define NC4 5801
+// gain
+#define GC1 0.742f
+#define GC2 0.733f
+#define GC3 0.715f
+#define GC4 0.697f
 #else
 // length of delay line
 #define NC1 479
 #define NC2 499
 #define NC3 539
 #define NC4 581
+// gain
+#define GC1 0.7f
+#define GC2 0.7f
+#define GC3 0.7f
+#define GC4 0.7f
 #endif
-// delay line
-static float cf1[NC1];
-static float cf2[NC2];
-static float cf3[NC3];
-static float cf4[NC4];
-// position in delay line
-static int ic1;
-static int ic2;
-static int ic3;
-static int ic4;
 
 //
 // DENORMALS ARE EVIL
@@ -105,129 +111,356 @@ static int ic4;
 // solution:
 // "it's better to burn out than to fade away"
 //
-// denormals are zero
-static inline float daz( float f )
+// the rt thread runs with flush to zero / denormals are zero
+// (tg_ftz() in connie_tg.c), no denormal is ever produced here.
+// without that (x87 math) the values going into the delay lines
+// are flushed in line_write().
+#if !defined( __SSE_MATH__ ) && !defined( __aarch64__ )
+#define REVERB_FLUSH
+#endif
+
+// E = 0, M != 0: count them (debug)
+// look at the bits, with DAZ set every float compare sees a zero
+static inline int is_denormal( float f )
 {
-  // define an aliasing type to perform a "reinterpret cast"
-  typedef __u32 __attribute__ (( __may_alias__ )) u32bit;
-  if ( *( (u32bit*)&f ) & 0x7F000000 ) // E > 1 : normal.
-    return f;
-  else // E <= 1 : zero or _almost_ denormal 
-       // (may become denormal with next operation)
-    return 0.0;
+  uint32_t u;
+  memcpy( &u, &f, sizeof( u ) );
+  return ( u & 0x7f800000 ) == 0 && ( u & 0x007fffff ) != 0;
 }
 
+#ifdef CONNIE_DENORMAL
+// written by the rt thread only
+static unsigned long long reverb_denormal_count = 0;
+#endif
 
-
-//
-// reverb for one sample
-//
-float reverb( float xin )
+// denormals seen in the delay lines
+unsigned long long reverb_denormals( void )
 {
-  static float yout = 0.0;
-  static float xv0, xv1, yv0, yv1;
-  float x, y;
+#ifdef CONNIE_DENORMAL
+  return __atomic_load_n( &reverb_denormal_count, __ATOMIC_RELAXED );
+#else
+  return 0;
+#endif
+}
 
-  // additional feedback
-  x  = daz( xin/8 + yout/64 );
 
-// three all pass filters
-  y = ap1[ia1];
-  ap1[ia1] = daz( GA1 * (x + y) );
-  x = y - x;
-  if ( ++ia1 >= NA1 )
-    ia1 = 0;
 
-  y = ap2[ia2];
-  ap2[ia2] = daz( GA2 * (x + y) );
-  x = y - x;
-  if ( ++ia2 >= NA2 )
-    ia2 = 0;
+// the sample rate the delays are scaled to
+static unsigned int reverb_rate( unsigned int sample_rate )
+{
+  if ( sample_rate < REVERB_RATE_MIN )
+    return REVERB_RATE_MIN;
+  if ( sample_rate > REVERB_RATE_MAX )
+    return REVERB_RATE_MAX;
+  return sample_rate;
+}
 
-  y = ap3[ia3];
-  ap3[ia3] = daz( GA3 * (x + y) );
-  x = y - x;
-  if ( ++ia3 >= NA3 )
-    ia3 = 0;
 
 
-#ifndef IIR
-// four feed forward comb filters 
+// a delay given for REVERB_RATE at this (clamped) sample rate
+static unsigned int reverb_delay( unsigned int delay, unsigned int sample_rate )
+{
+  return ( (unsigned long long)delay * sample_rate + REVERB_RATE / 2 ) / REVERB_RATE;
+}
 
-// gain
-#define GC1 0.742
-#define GC2 0.733
-#define GC3 0.715
-#define GC4 0.697
 
-  yout = 0;
 
-  yout += x + GC1 * cf1[ic1];
-  cf1[ic1] = x;
-  if ( ++ic1 >= NC1 )
-    ic1 = 0;
+// clear the state
+void reverb_init( reverb_t *rev, unsigned int sample_rate )
+{
+  static const unsigned int na[3] = { NA1, NA2, NA3 };
+  static const unsigned int nc[4] = { NC1, NC2, NC3, NC4 };
+  memset( rev, 0, sizeof( reverb_t ) );
+  sample_rate = reverb_rate( sample_rate );
+  for ( int k = 0; k < 3; k++ )
+    rev->na[k] = reverb_delay( na[k], sample_rate );
+  for ( int k = 0; k < 4; k++ )
+    rev->nc[k] = reverb_delay( nc[k], sample_rate );
+  // lowpass 3000 Hz, given for REVERB_RATE as in = 1/6, fb = 0.668:
+  // same time constant and dc gain at this rate
+  rev->lp_fb = powf( 0.668f, (float)REVERB_RATE / sample_rate );
+  rev->lp_in = ( 1.0f - rev->lp_fb ) / ( 1.0f - 0.668f ) / 6;
+}
 
-  yout += x + GC2 * cf2[ic2];
-  cf2[ic2] = x;
-  if ( ++ic2 >= NC2 )
-    ic2 = 0;
 
-  yout += x + GC3 * cf3[ic3];
-  cf3[ic3] = x;
-  if ( ++ic3 >= NC3 )
-    ic3 = 0;
 
-  yout += x + GC4 * cf4[ic4];
-  cf4[ic4] = x;
-  if ( ++ic4 >= NC4 )
-    ic4 = 0;
+// read n samples, the newest one delay frames before pos
+static void line_read( const float *line, unsigned int mask, unsigned int pos,
+                       unsigned int delay, float *dst, unsigned int n )
+{
+  unsigned int start = ( pos - delay ) & mask;
+  unsigned int first = mask + 1 - start;
+  if ( first >= n ) {
+    memcpy( dst, line + start, n * sizeof( float ) );
+  } else {
+    memcpy( dst, line + start, first * sizeof( float ) );
+    memcpy( dst + first, line, ( n - first ) * sizeof( float ) );
+  }
+}
 
+
+
+// write n samples at pos
+static void line_write( float *line, unsigned int mask, unsigned int pos,
+                        const float *src, unsigned int n )
+{
+#ifdef CONNIE_DENORMAL
+  unsigned int count = 0;
+  for ( unsigned int f = 0; f < n; f++ )
+    count += is_denormal( src[f] );
+  if ( count )
+    __atomic_store_n( &reverb_denormal_count, reverb_denormal_count + count, __ATOMIC_RELAXED );
+#endif
+  unsigned int start = pos & mask;
+  unsigned int first = mask + 1 - start;
+#ifdef REVERB_FLUSH
+  // E > 1 : normal, E <= 1 : zero or _almost_ denormal
+  // (may become denormal with next operation)
+  for ( unsigned int f = 0; f < n; f++ ) {
+    float s = fabsf( src[f] ) >= 2 * FLT_MIN ? src[f] : 0.0f;
+    line[ ( start + f ) & mask ] = s;
+  }
+  (void)first;
 #else
+  if ( first >= n ) {
+    memcpy( line + start, src, n * sizeof( float ) );
+  } else {
+    memcpy( line + start, src, first * sizeof( float ) );
+    memcpy( line, src + first, ( n - first ) * sizeof( float ) );
+  }
+#endif
+}
 
-// four recursive comb filters
 
-// gain
-#define GC1 0.7
-#define GC2 0.7
-#define GC3 0.7
-#define GC4 0.7
-
-  yout = 0.0;
-
-  y = cf1[ic1];
-  cf1[ic1] = daz( x + GC1 * y );
-  if ( ++ic1 >= NC1 )
-    ic1 = 0;
-  yout += y;
-
-  y = cf2[ic2];
-  cf2[ic2] = daz( x + GC2 * y );
-  if ( ++ic2 >= NC2 )
-    ic2 = 0;
-  yout += y;
-
-  y = cf3[ic3];
-  cf3[ic3] = daz( x + GC3 * y );
-  if ( ++ic3 >= NC3 )
-    ic3 = 0;
-  yout += y;
-
-  y = cf4[ic4];
-  cf4[ic4] = daz( x + GC4 * y );
-  if ( ++ic4 >= NC4 )
-    ic4 = 0;
-  yout += y;
 
+// one chunk, n <= REVERB_BLOCK
+static void reverb_chunk( reverb_t *rev, const float *in, float *out, unsigned int n )
+{
+  const unsigned int pos = rev->pos;
+  // delayed samples of this chunk, written before it
+  float y1[REVERB_BLOCK], y2[REVERB_BLOCK], y3[REVERB_BLOCK];
+  // input / 8 (in and out may be the same) and the fed back output
+  float x0[REVERB_BLOCK], fb[REVERB_BLOCK];
+  // comb output without the feedback part
+  float c[REVERB_BLOCK];
+
+  line_read( rev->ap1, REVERB_NA1-1, pos, rev->na[0], y1, n );
+  line_read( rev->ap2, REVERB_NA2-1, pos, rev->na[1], y2, n );
+  line_read( rev->ap3, REVERB_NA3-1, pos, rev->na[2], y3, n );
+#ifndef IIR
+  // four feed forward comb filters, four taps of one line
+  float t1[REVERB_BLOCK], t2[REVERB_BLOCK], t3[REVERB_BLOCK], t4[REVERB_BLOCK];
+  line_read( rev->cf, REVERB_NC-1, pos, rev->nc[0], t1, n );
+  line_read( rev->cf, REVERB_NC-1, pos, rev->nc[1], t2, n );
+  line_read( rev->cf, REVERB_NC-1, pos, rev->nc[2], t3, n );
+  line_read( rev->cf, REVERB_NC-1, pos, rev->nc[3], t4, n );
+  // each all pass gives y - x, so the combs see y3 - y2 + y1 - x,
+  // with x = in / 8 + feedback / 64
+  for ( unsigned int f = 0; f < n; f++ ) {
+    x0[f] = in[f] / 8;
+    c[f] = 4 * ( y3[f] - y2[f] + y1[f] - x0[f] )
+           + GC1 * t1[f] + GC2 * t2[f] + GC3 * t3[f] + GC4 * t4[f];
+  }
+#else
+  // four recursive comb filters, the output is the delayed part only
+  static const float gc[4] = { GC1, GC2, GC3, GC4 };
+  float t[4][REVERB_BLOCK];
+  for ( int k = 0; k < 4; k++ )
+    line_read( rev->cf[k], REVERB_NC-1, pos, rev->nc[k], t[k], n );
+  for ( unsigned int f = 0; f < n; f++ ) {
+    x0[f] = in[f] / 8;
+    c[f] = t[0][f] + t[1][f] + t[2][f] + t[3][f];
+  }
+#endif
+
+  // the frame by frame part: output feedback and IIR LP filter 3000 Hz
+  const float lp_in = rev->lp_in;
+  const float lp_fb = rev->lp_fb;
+  float xv1 = rev->xv1;
+  float yv1 = rev->yv1;
+  for ( unsigned int f = 0; f < n; f++ ) {
+    fb[f] = yv1;
+#ifndef IIR
+    const float y = c[f] - yv1 / 16; // 4 * -feedback / 64
+#else
+    const float y = c[f];
+#endif
+    float xv0 = xv1;
+    xv1 = lp_in * y;
+    yv1 = xv0 + xv1 + lp_fb * yv1;
+    out[f] = yv1;
+  }
+  rev->xv1 = xv1;
+#ifdef REVERB_FLUSH
+  if ( fabsf( yv1 ) < 2 * FLT_MIN )
+    yv1 = 0.0f;
 #endif
+  rev->yv1 = yv1;
+
+  // now with the feedback known: three all pass filters, the comb input
+  float v[REVERB_BLOCK];
+  float *x = x0;
+  for ( unsigned int f = 0; f < n; f++ ) {
+    x[f] += fb[f] / 64;
+    v[f] = GA1 * ( x[f] + y1[f] );
+    x[f] = y1[f] - x[f];
+  }
+  line_write( rev->ap1, REVERB_NA1-1, pos, v, n );
+  for ( unsigned int f = 0; f < n; f++ ) {
+    v[f] = GA2 * ( x[f] + y2[f] );
+    x[f] = y2[f] - x[f];
+  }
+  line_write( rev->ap2, REVERB_NA2-1, pos, v, n );
+  for ( unsigned int f = 0; f < n; f++ ) {
+    v[f] = GA3 * ( x[f] + y3[f] );
+    x[f] = y3[f] - x[f];
+  }
+  line_write( rev->ap3, REVERB_NA3-1, pos, v, n );
+#ifndef IIR
+  line_write( rev->cf, REVERB_NC-1, pos, x, n );
+#else
+  for ( int k = 0; k < 4; k++ ) {
+    for ( unsigned int f = 0; f < n; f++ )
+      v[f] = x[f] + gc[k] * t[k][f];
+    line_write( rev->cf[k], REVERB_NC-1, pos, v, n );
+  }
+#endif
+  rev->pos = pos + n;
+}
 
-  // IIR LP filter 3000 Hz
-  xv0 = xv1;
-  xv1 = yout/6;
-  yv0 = yv1;
-  yout = yv1 = daz( xv0 + xv1 + 0.668 * yv0 );
 
-  return yout;
 
+//
+// reverb for a block of samples, in and out may be the same
+//
+void reverb_process( reverb_t *rev, const float *in, float *out, unsigned int n )
+{
+  while ( n ) {
+    unsigned int chunk = n < REVERB_BLOCK ? n : REVERB_BLOCK;
+    reverb_chunk( rev, in, out, chunk );
+    in += chunk;
+    out += chunk;
+    n -= chunk;
+  }
 }
 
 
+
+// ***********************************************
+// stereo feedback delay network
+// ***********************************************
+//
+// FDN_LINES delay lines, mixed by a normalized hadamard matrix
+// (fast walsh hadamard transform, lines * log2( lines ) adds per frame).
+// each line has its decay gain for the reverb time and a two tap lowpass,
+// so the treble dies faster. mono in, the two outputs take orthogonal
+// sign patterns over the lines (two rows of the mixing) and are decorrelated.
+// like the JCRev above: chunks of REVERB_BLOCK frames, vectorized over
+// the frames of a chunk, delay lines wrap by mask.
+
+// reverb time (-60 dB) in seconds
+#define FDN_T60 1.8f
+// lowpass in the feedback: ( 1 - FDN_DAMP ) * z[n] + FDN_DAMP * z[n-1]
+#define FDN_DAMP 0.3f
+// output level, about the same loudness as the JCRev
+#define FDN_OUT 0.4f
+
+// delay lengths, 16 lines, every 2nd for 8 lines, every 4th for 4 lines
+static const unsigned int fdn_len[FDN_LINES] = {
+  601, 709, 823, 947, 1069, 1193, 1327, 1459,
+  1601, 1741, 1889, 2039, 2179, 2333, 2477, 2621
+};
+
+
+
+// clear the state, lines: 4, 8 or 16
+void fdn_init( fdn_t *fdn, int lines, unsigned int sample_rate )
+{
+  if ( lines != 4 && lines != 8 && lines != 16 )
+    lines = 8;
+  fdn->lines = lines;
+  fdn->pos = 0;
+  sample_rate = reverb_rate( sample_rate );
+  // the longest line of this rate fits into mask + 1
+  fdn->mask = 1;
+  while ( fdn->mask <= reverb_delay( fdn_len[ FDN_LINES - 1 ], sample_rate ) )
+    fdn->mask <<= 1;
+  fdn->mask--;
+  for ( int i = 0; i < lines; i++ ) {
+    fdn->len[i] = reverb_delay( fdn_len[ i * FDN_LINES / lines ], sample_rate );
+    // decay per pass, the hadamard matrix is normalized here
+    fdn->gain[i] = powf( 10.0f, -3.0f * fdn->len[i] / ( FDN_T60 * sample_rate ) )
+                   / sqrtf( lines );
+    fdn->last[i] = 0.0f;
+    memset( fdn->line[i], 0, ( fdn->mask + 1 ) * sizeof( float ) );
+  }
+}
+
+
+
+// one chunk, n <= REVERB_BLOCK
+static void fdn_chunk( fdn_t *fdn, const float *in, float *out_l, float *out_r, unsigned int n )
+{
+  const int lines = fdn->lines;
+  const unsigned int pos = fdn->pos;
+  float y[FDN_LINES][REVERB_BLOCK];
+
+  // the line outputs
+  for ( int i = 0; i < lines; i++ )
+    line_read( fdn->line[i], fdn->mask, pos, fdn->len[i], y[i], n );
+
+  // hadamard mixing, in place
+  for ( int h = 1; h < lines; h <<= 1 ) {
+    for ( int i = 0; i < lines; i += 2 * h ) {
+      for ( int j = i; j < i + h; j++ ) {
+        for ( unsigned int f = 0; f < n; f++ ) {
+          float a = y[j][f];
+          float b = y[j+h][f];
+          y[j][f] = a + b;
+          y[j+h][f] = a - b;
+        }
+      }
+    }
+  }
+
+  // the outputs are two rows of the hadamard matrix (orthogonal):
+  // left: + - + - ..., right: + + - - ...
+  const float out = FDN_OUT / sqrtf( lines );
+  for ( unsigned int f = 0; f < n; f++ ) {
+    out_l[f] = out * y[1][f];
+    out_r[f] = out * y[2][f];
+  }
+
+  // lowpass, decay, add the input and feed back
+  for ( int i = 0; i < lines; i++ ) {
+    const float gain = fdn->gain[i];
+    // input signs: a bent function of the line number, spreads the
+    // input over all rows of the mixing (not just one output)
+    const float sign = ( ( i & ( i >> 1 ) ) ^ ( ( i >> 2 ) & ( i >> 3 ) ) ) & 1 ? -1.0f : 1.0f;
+    float w[REVERB_BLOCK];
+    w[0] = gain * ( ( 1 - FDN_DAMP ) * y[i][0] + FDN_DAMP * fdn->last[i] ) + sign * in[0];
+    for ( unsigned int f = 1; f < n; f++ )
+      w[f] = gain * ( ( 1 - FDN_DAMP ) * y[i][f] + FDN_DAMP * y[i][f-1] ) + sign * in[f];
+    fdn->last[i] = y[i][n-1];
+    line_write( fdn->line[i], fdn->mask, pos, w, n );
+  }
+
+  fdn->pos = pos + n;
+}
+
+
+
+//
+// stereo reverb for a block of samples (wet only)
+//
+void fdn_process( fdn_t *fdn, const float *in, float *out_l, float *out_r, unsigned int n )
+{
+  while ( n ) {
+    unsigned int chunk = n < REVERB_BLOCK ? n : REVERB_BLOCK;
+    fdn_chunk( fdn, in, out_l, out_r, chunk );
+    in += chunk;
+    out_l += chunk;
+    out_r += chunk;
+    n -= chunk;
+  }
+}
@@ -22,5 +22,77 @@
  *
  ******************************************************************************/
  
-extern float  reverb( float sample );
+#ifndef REVERB_H
+#define REVERB_H
 
+// to replace the feed forward comb filters with IIR filters uncomment next line
+// #define IIR
+
+// max frames per chunk, less than the shortest delay
+#define REVERB_BLOCK 32
+
+// the delays are given for REVERB_RATE and scaled to the sample rate,
+// rates outside REVERB_RATE_MIN..REVERB_RATE_MAX are clamped
+#define REVERB_RATE 48000
+#define REVERB_RATE_MIN 16000
+#define REVERB_RATE_MAX 192000
+
+// delay lines, powers of 2, long enough for REVERB_RATE_MAX
+#define REVERB_NA1 8192
+#define REVERB_NA2 2048
+#define REVERB_NA3 512
+#ifndef IIR
+#define REVERB_NC 32768
+#else
+#define REVERB_NC 4096
+#endif
+
+// the state of one reverb
+typedef struct {
+  float ap1[REVERB_NA1];
+  float ap2[REVERB_NA2];
+  float ap3[REVERB_NA3];
+#ifndef IIR
+  float cf[REVERB_NC];    // one line, four taps
+#else
+  float cf[4][REVERB_NC];
+#endif
+  float xv1, yv1;         // lowpass, yv1 is the last output
+  unsigned int pos;       // write position of all lines, wraps by mask
+  unsigned int na[3];     // delays at this sample rate
+  unsigned int nc[4];
+  float lp_in, lp_fb;     // lowpass coefficients at this sample rate
+} reverb_t;
+
+// clear the state, delays and lowpass for this sample rate
+extern void reverb_init( reverb_t *rev, unsigned int sample_rate );
+
+// mono in, mono out (wet only), in and out may be the same
+extern void reverb_process( reverb_t *rev, const float *in, float *out, unsigned int n );
+
+// denormal values written to the delay lines since start
+// counted with -DCONNIE_DENORMAL only, 0 otherwise
+extern unsigned long long reverb_denormals( void );
+
+// stereo feedback delay network, 4, 8 or 16 lines
+#define FDN_LINES 16
+#define FDN_LEN 16384
+
+typedef struct {
+  int lines;
+  unsigned int pos;
+  unsigned int mask;      // of the lines in use, up to FDN_LEN - 1
+  unsigned int len[FDN_LINES];
+  float gain[FDN_LINES];
+  float last[FDN_LINES];
+  float line[FDN_LINES][FDN_LEN];
+} fdn_t;
+
+// clear the state, lines: 4, 8 or 16 (cpu load grows with the lines)
+// delays and decay for this sample rate
+extern void fdn_init( fdn_t *fdn, int lines, unsigned int sample_rate );
+
+// mono in, stereo out (wet only)
+extern void fdn_process( fdn_t *fdn, const float *in, float *out_l, float *out_r, unsigned int n );
+
+#endif